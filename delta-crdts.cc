@@ -31,11 +31,25 @@
 #include <unordered_set>
 #include <map>
 #include <list>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <exception>
 #include <tuple>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <type_traits>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+#include <cstdint>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -70,6 +84,16 @@ T join(const T& l, const T& r) // assuming copy constructor
   return join_selector< is_arithmetic<T>::value >::join(l,r);
 }
 
+template<typename T> // Join a left object that is no longer needed, uncopied
+auto join(T&& l, const T& r) -> typename 
+  enable_if<! is_lvalue_reference<T>::value, decltype(l.join(r),T())>::type
+{
+  T res;
+  res=std::move(l); // as a copy, keeping the id, moved where it can be
+  res.join(r);
+  return res;
+}
+
 template<typename A, typename B> // Join two pairs of objects
 pair<A,B> join(const pair<A,B>& l, const pair<A,B>& r)
 {
@@ -104,8 +128,8 @@ ostream &operator<<( ostream &output, const pair<A,B>& o)
   return output;
 }
 
-template<typename T> // Output a set
-ostream &operator<<( ostream &output, const set<T>& o)
+template<typename T, typename C, typename L> // Output a set
+ostream &operator<<( ostream &output, const set<T,C,L>& o)
 {
   output << "( ";
   for (const auto& e : o) output << e << " ";
@@ -161,553 +185,3122 @@ ostream &operator<<( ostream &output, const vector<T>& o)
   return output;
 }
 
-// Autonomous causal context, for context sharing in maps
-template<typename K>
-class dotcontext
+// Binary wire format
+//
+// Encoded CRDTs start with a magic byte and a format version. Integers are
+// written as varints (zigzag for signed types), floating point numbers as 
+// little endian IEEE 754, and replica ids are written in full only once per 
+// message and then referred to by their position in a dictionary. 
+
+const unsigned char wiremagic=0xD7;
+const unsigned char wireversion=1;
+// Most dots a message may add to the dot clouds it is decoded into, as runs
+// of dots are short in the encoding but take a node per dot once decoded
+const size_t wiremaxcloud=1<<20;
+
+class wireout // Encoding buffer
 {
+  string buf;
+  map<string,unsigned long long> ids; // encoded id -> dictionary position
+
 public:
-  map<K,int> cc; // Compact causal context
-  set<pair<K,int> > dc; // Dot cloud
+  const string & bytes() const { return buf; }
 
-  dotcontext<K> & operator=(const dotcontext<K> & o)
-  {
-    if (&o == this) return *this;
-    cc=o.cc; dc=o.dc;
-    return *this;
-  }
+  void clear() { buf.clear(); ids.clear(); } // Keeps the buffer capacity
 
-  friend ostream &operator<<( ostream &output, const dotcontext<K>& o)
-  { 
-    output << "Context:";
-    output << " CC ( ";
-    for (const auto & ki : o.cc)
-      output << ki.first << ":" << ki.second << " ";
-    output << ")";
-    output << " DC ( ";
-    for (const auto & ki : o.dc)
-      output << ki.first << ":" << ki.second << " ";
-    output << ")";
-    return output;            
-  }
+  void byte(unsigned char b) { buf.push_back(b); }
 
-  bool dotin (const pair<K,int> & d) const
-  {
-    const auto itm = cc.find(d.first);
-    if (itm != cc.end() && d.second <= itm->second) return true;
-    if (dc.count(d)!=0) return true;
-    return false;
+  void raw(const void * p, size_t n) 
+  { 
+    buf.append(static_cast<const char *>(p),n); 
   }
 
-  void compact()
+  void uvarint(unsigned long long v)
   {
-    // Compact DC to CC if possible
-    //typename map<K,int>::iterator mit;
-    //typename set<pair<K,int> >::iterator sit;
-    bool flag; // may need to compact several times if ordering not best
-    do
+    while (v >= 0x80)
     {
-      flag=false;
-      for(auto sit = dc.begin(); sit != dc.end();)
-      {
-        auto mit=cc.find(sit->first); 
-        if (mit==cc.end()) // No CC entry
-          if (sit->second == 1) // Can compact
-          {
-            cc.insert(*sit);
-            dc.erase(sit++);
-            flag=true;
-          }
-          else ++sit;
-        else // there is a CC entry already
-          if (sit->second == cc.at(sit->first) + 1) // Contiguous, can compact
-          {
-            cc.at(sit->first)++;
-            dc.erase(sit++);
-            flag=true;
-          }
-          else 
-            if (sit->second <= cc.at(sit->first)) // dominated, so prune
-            {
-              dc.erase(sit++);
-              // no extra compaction oportunities so flag untouched
-            }
-            else ++sit;
-      }
+      buf.push_back(static_cast<char>((v & 0x7F) | 0x80));
+      v >>= 7;
     }
-    while(flag==true);
-  }
-
-  pair<K,int> makedot(const K & id)
-  {
-    // On a valid dot generator, all dots should be compact on the used id
-    // Making the new dot, updates the dot generator and returns the dot
-    // pair<typename map<K,int>::iterator,bool> ret;
-    auto kib=cc.insert(pair<K,int>(id,1));
-    if (kib.second==false) // already there, so update it
-      (kib.first->second)+=1;
-    //return dot;
-    return pair<K,int>(*kib.first);
-  }
-
-  void insertdot(const pair<K,int> & d, bool compactnow=true)
-  {
-    // Set
-    dc.insert(d);
-    if (compactnow) compact();
+    buf.push_back(static_cast<char>(v));
   }
 
-
-  void join (const dotcontext<K> & o)
+  void svarint(long long v)
   {
-    if (this == &o) return; // Join is idempotent, but just dont do it.
-    // CC
-    //typename  map<K,int>::iterator mit;
-    //typename  map<K,int>::const_iterator mito;
-    auto mit=cc.begin(); auto mito=o.cc.begin();
-    do 
-    {
-      if (mit != cc.end() && (mito == o.cc.end() || mit->first < mito->first))
-      {
-        // cout << "cc one\n";
-        // entry only at here
-        ++mit;
-      }
-      else if (mito != o.cc.end() && (mit == cc.end() || mito->first < mit->first))
-      {
-        // cout << "cc two\n";
-        // entry only at other
-        cc.insert(*mito);
-        ++mito;
-      }
-      else if ( mit != cc.end() && mito != o.cc.end() )
-      {
-        // cout << "cc three\n";
-        // in both
-        cc.at(mit->first)=max(mit->second,mito->second);
-        ++mit; ++mito;
-      }
-    } while (mit != cc.end() || mito != o.cc.end());
-    // DC
-    // Set
-    for (const auto & e : o.dc)
-      insertdot(e,false);
-
-    compact();
-
+    uvarint((static_cast<unsigned long long>(v) << 1) ^ 
+      static_cast<unsigned long long>(v >> 63));
   }
 
+  template<typename K> void id(const K & k); // Replica id, via dictionary
 };
 
-template <typename T, typename K>
-class dotkernel
+class wirein // Decoding cursor over a buffer, that is not copied
 {
-public:
-
-  map<pair<K,int>,T> ds;  // Map of dots to vals
-
-  dotcontext<K> cbase;
-  dotcontext<K> & c;
-
-  // if no causal context supplied, used base one
-  dotkernel() : c(cbase) {} 
-  // if supplied, use a shared causal context
-  dotkernel(dotcontext<K> &jointc) : c(jointc) {} 
-//  dotkernel(const dotkernel<T,K> &adk) : c(adk.c), ds(adk.ds) {}
+  const unsigned char * p;
+  const unsigned char * e;
+  bool ok;
+  // Dictionary of ids, kept as the byte ranges of their first encoding
+  vector<pair<const unsigned char *,const unsigned char *> > ids;
 
-  dotkernel<T,K> & operator=(const dotkernel<T,K> & adk)
+public:
+  wirein(const unsigned char * b, size_t n) : p(b), e(b+n), ok(true) {}
+  wirein(const string & b) : 
+    p(reinterpret_cast<const unsigned char *>(b.data())), 
+    e(reinterpret_cast<const unsigned char *>(b.data())+b.size()), 
+    ok(true) {}
+
+  bool good() const { return ok; }
+  void fail() { ok=false; p=e; }
+  size_t left() const { return e-p; }
+  const unsigned char * pos() const { return p; }
+
+  unsigned char byte()
   {
-    if (&adk == this) return *this;
-    if (&c != &adk.c) c=adk.c; 
-    ds=adk.ds;
-    return *this;
+    if (p == e) { fail(); return 0; }
+    return *p++;
   }
 
-  friend ostream &operator<<( ostream &output, const dotkernel<T,K>& o)
-  { 
-    output << "Kernel: DS ( ";
-    for (const auto & dv : o.ds)
-      output <<  dv.first.first << ":" << dv.first.second << 
-        "->" << dv.second << " ";
-    output << ") ";
-
-    cout << o.c;
-
-    return output;            
+  bool raw(void * d, size_t n)
+  {
+    if (n > left()) { fail(); return false; }
+    memcpy(d,p,n); p+=n;
+    return true;
   }
 
-  void join (const dotkernel<T,K> & o)
+  bool skip(size_t n)
   {
-    if (this == &o) return; // Join is idempotent, but just dont do it.
-    // DS
-    // will iterate over the two sorted sets to compute join
-    //typename  map<pair<K,int>,T>::iterator it;
-    //typename  map<pair<K,int>,T>::const_iterator ito;
-    auto it=ds.begin(); auto ito=o.ds.begin();
-    do 
-    {
-      if ( it != ds.end() && ( ito == o.ds.end() || it->first < ito->first))
-      {
-        // dot only at this
-        if (o.c.dotin(it->first)) // other knows dot, must delete here 
-          ds.erase(it++);
-        else // keep it
-          ++it;
-      }
-      else if ( ito != o.ds.end() && ( it == ds.end() || ito->first < it->first))
-      {
-        // dot only at other
-        if(! c.dotin(ito->first)) // If I dont know, import
-          ds.insert(*ito);
-        ++ito;
-      }
-      else if ( it != ds.end() && ito != o.ds.end() )
-      {
-        // dot in both
-        ++it; ++ito;
-      }
-    } while (it != ds.end() || ito != o.ds.end() );
-    // CC
-    c.join(o.c);
+    if (n > left()) { fail(); return false; }
+    p+=n;
+    return true;
   }
 
-  void deepjoin (const dotkernel<T,K> & o)
+  unsigned long long uvarint()
   {
-    if (this == &o) return; // Join is idempotent, but just dont do it.
-    // DS
-    // will iterate over the two sorted sets to compute join
-    //typename  map<pair<K,int>,T>::iterator it;
-    //typename  map<pair<K,int>,T>::const_iterator ito;
-    auto it=ds.begin(); auto ito=o.ds.begin();
-    do 
+    unsigned long long v=0;
+    for (int s=0; s < 64; s+=7)
     {
-      if ( it != ds.end() && ( ito == o.ds.end() || it->first < ito->first))
-      {
-        // dot only at this
-        if (o.c.dotin(it->first)) // other knows dot, must delete here 
-          ds.erase(it++);
-        else // keep it
-          ++it;
-      }
-      else if ( ito != o.ds.end() && ( it == ds.end() || ito->first < it->first))
-      {
-        // dot only at other
-        if(! c.dotin(ito->first)) // If I dont know, import
-          ds.insert(*ito);
-        ++ito;
-      }
-      else if ( it != ds.end() && ito != o.ds.end() )
-      {
-        // dot in both
-        // check it payloads are diferent 
-        if (it->second != ito->second)
-        {
-          // if payloads are not equal, they must be mergeable
-          // use the more general binary join
-          it->second=::join(it->second,ito->second);
-        }
-        ++it; ++ito;
-      }
-    } while (it != ds.end() || ito != o.ds.end() );
-    // CC
-    c.join(o.c);
+      unsigned char b=byte();
+      v |= static_cast<unsigned long long>(b & 0x7F) << s;
+      if ((b & 0x80) == 0) return v;
+    }
+    fail(); // overlong varint
+    return 0;
   }
 
-
-  dotkernel<T,K> add (const K& id, const T& val) 
+  long long svarint()
   {
-    dotkernel<T,K> res;
-    // get new dot
-    pair<K,int> dot=c.makedot(id);
-    // add under new dot
-    ds.insert(pair<pair<K,int>,T>(dot,val));
-    // make delta
-    res.ds.insert(pair<pair<K,int>,T>(dot,val));
-    res.c.insertdot(dot);
-    return res;
+    unsigned long long u=uvarint();
+    return static_cast<long long>(u >> 1) ^ -static_cast<long long>(u & 1);
   }
 
-  // Add that returns the added dot, instead of kernel delta
-  pair<K,int> dotadd (const K& id, const T& val)
+  // Element counts can not exceed the bytes left, as each takes at least one
+  size_t count()
   {
-    // get new dot
-    pair<K,int> dot=c.makedot(id);
-    // add under new dot
-    ds.insert(pair<pair<K,int>,T>(dot,val));
-    return dot;
+    unsigned long long n=uvarint();
+    if (n > left()) { fail(); return 0; }
+    return n;
   }
 
-  dotkernel<T,K> rmv (const T& val)  // remove all dots matching value
-  {
-    dotkernel<T,K> res;
-    //typename  map<pair<K,int>,T>::iterator dsit;
-    for(auto dsit=ds.begin(); dsit != ds.end();)
-    {
-      if (dsit->second == val) // match
-      {
-        res.c.insertdot(dsit->first,false); // result knows removed dots
-        ds.erase(dsit++);
-      }
-      else
-        ++dsit;
-    }
-    res.c.compact(); // Maybe several dots there, so atempt compactation
-    return res;
-  }
+  template<typename K> void id(K & k); // Replica id, via dictionary
 
-  dotkernel<T,K> rmv (const pair<K,int>& dot)  // remove a dot 
+  // Run of int dots, encoded as the gap from the last dot of the previous
+  // run and the run length minus one. Fails on runs outside of int
+  bool run(int & last, int & first)
   {
-    dotkernel<T,K> res;
-    auto dsit=ds.find(dot);
-    if (dsit != ds.end()) // found it
+    long long gap=svarint();
+    unsigned long long len=uvarint();
+    if (! ok || gap < numeric_limits<int>::min()-static_cast<long long>(last) ||
+        gap > numeric_limits<int>::max()-static_cast<long long>(last)) 
+    { 
+      fail(); return false; 
+    }
+    first=static_cast<int>(last+gap);
+    if (len > static_cast<unsigned long long>(numeric_limits<int>::max()-first))
     {
-      res.c.insertdot(dsit->first,false); // result knows removed dots
-      ds.erase(dsit++);
+      fail(); return false;
     }
-    res.c.compact(); // Atempt compactation
-    return res;
+    last=first+static_cast<int>(len);
+    return true;
   }
 
-  dotkernel<T,K> rmv ()  // remove all dots 
+  // Gap to the next dot of a store, failing when it leaves int
+  bool next(int & last)
   {
-    dotkernel<T,K> res;
-    for (const auto & dv : ds) 
-      res.c.insertdot(dv.first,false);
-    res.c.compact();
-    ds.clear(); // Clear the payload, but remember context
-    return res;
+    long long gap=svarint();
+    if (! ok || gap < numeric_limits<int>::min()-static_cast<long long>(last) ||
+        gap > numeric_limits<int>::max()-static_cast<long long>(last)) 
+    { 
+      fail(); return false; 
+    }
+    last=static_cast<int>(last+gap);
+    return true;
   }
-
 };
 
-template <typename V=int, typename K=string>
-class gcounter
+// Encoding of values, CRDTs provide encode and decode members
+template<typename T> typename enable_if<is_integral<T>::value>::type 
+  encode(wireout & w, const T & v);
+template<typename T> typename enable_if<is_integral<T>::value>::type 
+  decode(wirein & r, T & v);
+template<typename T> typename enable_if<is_floating_point<T>::value>::type 
+  encode(wireout & w, const T & v);
+template<typename T> typename enable_if<is_floating_point<T>::value>::type 
+  decode(wirein & r, T & v);
+void encode(wireout & w, const string & v);
+void decode(wirein & r, string & v);
+void encode(wireout & w, const vector<bool> & v);
+void decode(wirein & r, vector<bool> & v);
+template<typename A, typename B> void encode(wireout & w, const pair<A,B> & v);
+template<typename A, typename B> void decode(wirein & r, pair<A,B> & v);
+template<typename T> void encode(wireout & w, const vector<T> & v);
+template<typename T> void decode(wirein & r, vector<T> & v);
+template<typename T, typename C, typename L> 
+  void encode(wireout & w, const set<T,C,L> & v);
+template<typename T, typename C, typename L> 
+  void decode(wirein & r, set<T,C,L> & v);
+template<typename A, typename B, typename C, typename L> 
+  void encode(wireout & w, const map<A,B,C,L> & v);
+template<typename A, typename B, typename C, typename L> 
+  void decode(wirein & r, map<A,B,C,L> & v);
+template<typename T> typename enable_if<is_class<T>::value>::type 
+  encode(wireout & w, const T & v);
+template<typename T> typename enable_if<is_class<T>::value>::type 
+  decode(wirein & r, T & v);
+
+template<typename T> typename enable_if<is_integral<T>::value>::type 
+  encode(wireout & w, const T & v)
 {
-private:
-  map<K,V> m;
-  K id;
-
-public:
-  gcounter() {} // Only for deltas and those should not be mutated
-  gcounter(K a) : id(a) {} // Mutable replicas need a unique id
+  if (is_signed<T>::value) 
+    w.svarint(static_cast<long long>(v));
+  else 
+    w.uvarint(static_cast<unsigned long long>(v));
+}
 
-  gcounter inc(V tosum={1}) // argument is optional
+template<typename T> typename enable_if<is_integral<T>::value>::type 
+  decode(wirein & r, T & v)
+{
+  if (is_signed<T>::value) 
   {
-    gcounter<V,K> res;
-    m[id]+=tosum;
-    res.m[id]=m[id];
-    return res;
+    long long x=r.svarint();
+    v=static_cast<T>(x);
+    if (static_cast<long long>(v) != x) r.fail(); // does not fit
   }
+  else
+  {
+    unsigned long long x=r.uvarint();
+    v=static_cast<T>(x);
+    if (static_cast<unsigned long long>(v) != x) r.fail(); // does not fit
+  }
+}
 
-  bool operator == ( const gcounter<V,K>& o ) const 
+template<typename T> typename enable_if<is_floating_point<T>::value>::type 
+  encode(wireout & w, const T & v)
+{
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "IEEE 754 single or double");
+  unsigned long long u=0;
+  if (sizeof(T) == 4) 
   { 
-    return m==o.m; 
+    float f=static_cast<float>(v); uint32_t b; memcpy(&b,&f,4); u=b; 
   }
-
-  V local() // get local counter value // CBM make this const
+  else 
   {
-    V res=0;
-    res += m[id];
-    return res;
+    double d=static_cast<double>(v); memcpy(&u,&d,8);
   }
+  for (size_t i=0; i < sizeof(T); i++) 
+    w.byte(static_cast<unsigned char>(u >> (8*i)));
+}
 
-  V read() const // get counter value
+template<typename T> typename enable_if<is_floating_point<T>::value>::type 
+  decode(wirein & r, T & v)
+{
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "IEEE 754 single or double");
+  unsigned long long u=0;
+  for (size_t i=0; i < sizeof(T); i++) 
+    u |= static_cast<unsigned long long>(r.byte()) << (8*i);
+  if (sizeof(T) == 4) 
   {
-    V res=0;
-    for (const auto& kv : m) // Fold+ on value list
-      res += kv.second;
-    return res;
+    uint32_t b=static_cast<uint32_t>(u); float f; memcpy(&f,&b,4); v=f;
   }
-
-  void join(const gcounter<V,K>& o)
+  else
   {
-    for (const auto& okv : o.m)
-      m[okv.first]=max(okv.second,m[okv.first]);
-  }
-
-  friend ostream &operator<<( ostream &output, const gcounter<V,K>& o)
-  { 
-    output << "GCounter: ( ";
-    for (const auto& kv : o.m)
-      output << kv.first << "->" << kv.second << " ";
-    output << ")";
-    return output;            
+    double d; memcpy(&d,&u,8); v=static_cast<T>(d);
   }
+}
 
-};
+inline void encode(wireout & w, const string & v)
+{
+  w.uvarint(v.size());
+  w.raw(v.data(),v.size());
+}
 
-template <typename V=int, typename K=string>
-class pncounter
+inline void decode(wirein & r, string & v)
 {
-private:
-  gcounter<V,K> p,n;
+  size_t n=r.count();
+  v.assign(reinterpret_cast<const char *>(r.pos()),n);
+  r.skip(n);
+}
 
-public:
+inline void encode(wireout & w, const vector<bool> & v) // Packed bits
+{
+  w.uvarint(v.size());
+  unsigned char b=0;
+  for (size_t i=0; i < v.size(); i++)
+  {
+    if (v[i]) b |= 1 << (i%8);
+    if (i%8 == 7 || i+1 == v.size()) { w.byte(b); b=0; }
+  }
+}
+
+inline void decode(wirein & r, vector<bool> & v)
+{
+  unsigned long long n=r.uvarint();
+  v.clear();
+  if (n > 8*static_cast<unsigned long long>(r.left())) { r.fail(); return; }
+  unsigned char b=0;
+  for (size_t i=0; i < n; i++)
+  {
+    if (i%8 == 0) b=r.byte();
+    v.push_back((b >> (i%8)) & 1);
+  }
+}
+
+template<typename A, typename B> void encode(wireout & w, const pair<A,B> & v)
+{
+  encode(w,v.first); encode(w,v.second);
+}
+
+template<typename A, typename B> void decode(wirein & r, pair<A,B> & v)
+{
+  decode(r,v.first); decode(r,v.second);
+}
+
+template<typename T> void encode(wireout & w, const vector<T> & v)
+{
+  w.uvarint(v.size());
+  for (const auto & e : v) encode(w,e);
+}
+
+template<typename T> void decode(wirein & r, vector<T> & v)
+{
+  v.clear();
+  for (size_t n=r.count(); n > 0 && r.good(); n--)
+  {
+    v.push_back(T());
+    decode(r,v.back());
+  }
+}
+
+template<typename T, typename C, typename L> 
+  void encode(wireout & w, const set<T,C,L> & v)
+{
+  w.uvarint(v.size());
+  for (const auto & e : v) encode(w,e);
+}
+
+template<typename T, typename C, typename L> 
+  void decode(wirein & r, set<T,C,L> & v)
+{
+  v.clear();
+  for (size_t n=r.count(); n > 0 && r.good(); n--)
+  {
+    T e;
+    decode(r,e);
+    v.insert(v.end(),e);
+  }
+}
+
+template<typename A, typename B, typename C, typename L> 
+  void encode(wireout & w, const map<A,B,C,L> & v)
+{
+  w.uvarint(v.size());
+  for (const auto & e : v) { encode(w,e.first); encode(w,e.second); }
+}
+
+template<typename A, typename B, typename C, typename L> 
+  void decode(wirein & r, map<A,B,C,L> & v)
+{
+  v.clear();
+  for (size_t n=r.count(); n > 0 && r.good(); n--)
+  {
+    pair<A,B> e;
+    decode(r,e.first); decode(r,e.second);
+    v.insert(v.end(),e);
+  }
+}
+
+template<typename T> typename enable_if<is_class<T>::value>::type 
+  encode(wireout & w, const T & v)
+{
+  v.encode(w);
+}
+
+template<typename T> typename enable_if<is_class<T>::value>::type 
+  decode(wirein & r, T & v)
+{
+  v.decode(r);
+}
+
+template<typename K> void wireout::id(const K & k)
+{
+  wireout t;
+  ::encode(t,k);
+  auto it=ids.find(t.buf);
+  if (it != ids.end()) // already known, refer to its position
+  {
+    uvarint(it->second+1);
+    return;
+  }
+  uvarint(0); // new id, written in full
+  buf+=t.buf;
+  ids.insert(pair<string,unsigned long long>(t.buf,ids.size()));
+}
+
+template<typename K> void wirein::id(K & k)
+{
+  unsigned long long n=uvarint();
+  if (n == 0) // new id, remember where it was
+  {
+    const unsigned char * b=p;
+    ::decode(*this,k);
+    ids.push_back(make_pair(b,p));
+  }
+  else if (n <= ids.size()) // known id, decode it again from its bytes
+  {
+    wirein t(ids[n-1].first,ids[n-1].second-ids[n-1].first);
+    ::decode(t,k);
+  }
+  else 
+    fail();
+}
+
+template<typename T> // Encode a CRDT (or any encodable value) into a message
+string serialize(const T & o)
+{
+  wireout w;
+  w.byte(wiremagic);
+  w.byte(wireversion);
+  encode(w,o);
+  return w.bytes();
+}
+
+inline bool wireheader(wirein & r) // Check the magic and format version
+{
+  return r.byte() == wiremagic && r.byte() == wireversion && r.good();
+}
+
+template<typename T> // Decode a message into o, false if it is malformed
+bool deserialize(const string & b, T & o)
+{
+  wirein r(b);
+  if (! wireheader(r)) return false;
+  decode(r,o);
+  return r.good() && r.left() == 0;
+}
+
+template<typename T> // Join a message into o without decoding it first
+bool joinbytes(T & o, const string & b)
+{
+  wirein r(b);
+  if (! wireheader(r)) return false;
+  typename T::view v(r); // checks the encoding
+  if (! r.good() || r.left() != 0) return false;
+  o.join(v);
+  return true;
+}
+
+// Replica ids interned to small integers, usable as K by all datatypes. 
+// Dots then copy and test equal as integers, instead of strings. Numbers 
+// are local to each process, so ids are ordered and encoded by their names
+class replicaid
+{
+private:
+  uint32_t i;
+
+  struct registry
+  {
+    static const size_t chunk=1024, chunks=4096; // up to 4M names
+    mutex m;
+    // Names by number, in chunks that are never moved, so that they are 
+    // read without the lock. A number is only handed out once its name 
+    // is written, under the lock
+    string * names[chunks];
+    size_t size=0;
+    unordered_map<string,uint32_t> numbers;
+    registry() : names() { add(string()); }
+
+    uint32_t add(const string & name)
+    {
+      assert(size < chunk*chunks);
+      if (size%chunk == 0) names[size/chunk]=new string[chunk];
+      names[size/chunk][size%chunk]=name;
+      numbers[name]=static_cast<uint32_t>(size);
+      return static_cast<uint32_t>(size++);
+    }
+  };
+
+  static registry & reg()
+  {
+    static registry * r=new registry(); // never destroyed, ids may outlive it
+    return *r;
+  }
+
+  static uint32_t intern(const string & name)
+  {
+    registry & r=reg();
+    lock_guard<mutex> lock(r.m);
+    auto it=r.numbers.find(name);
+    if (it != r.numbers.end()) return it->second;
+    return r.add(name);
+  }
+
+public:
+  replicaid() : i(0) {} // The empty name
+  replicaid(const string & name) : i(intern(name)) {}
+  replicaid(const char * name) : i(intern(name)) {}
+
+  const string & name() const 
+  { 
+    return reg().names[i/registry::chunk][i%registry::chunk]; 
+  }
+
+  uint32_t number() const { return i; }
+
+  bool operator==(const replicaid & o) const { return i == o.i; }
+  bool operator!=(const replicaid & o) const { return i != o.i; }
+  // By name, as in every other process, see orseq::join and decode
+  bool operator<(const replicaid & o) const 
+  { 
+    return i != o.i && name() < o.name(); 
+  }
+  bool operator>(const replicaid & o) const { return o < *this; }
+  bool operator<=(const replicaid & o) const { return ! (o < *this); }
+  bool operator>=(const replicaid & o) const { return ! (*this < o); }
+
+  friend ostream &operator<<( ostream &output, const replicaid & o)
+  {
+    return output << o.name();
+  }
+
+  void encode(wireout & w) const { ::encode(w,name()); }
+
+  void decode(wirein & r) 
+  { 
+    string n; 
+    ::decode(r,n); 
+    if (r.good()) i=intern(n); 
+  }
+};
+
+namespace std 
+{
+  template<> struct hash<replicaid>
+  {
+    size_t operator()(const replicaid & k) const { return k.number(); }
+  };
+}
+
+// Monotonic arena, for short lived objects such as deltas. Allocation
+// bumps a pointer in the current block, freeing does nothing, and all 
+// memory is reclaimed at once by reset (keeping the blocks for reuse) or 
+// release. Objects allocated in an arena must not outlive its reset.
+class arena
+{
+private:
+  vector<pair<char *,size_t> > blocks;
+  size_t cur=0; // Block in use
+  char * p=NULL; 
+  char * e=NULL;
+  size_t blocksize;
+
+public:
+  explicit arena(size_t bs=64*1024) : blocksize(bs) {}
+  arena(const arena &) = delete;
+  arena & operator=(const arena &) = delete;
+  ~arena() { release(); }
+
+  void * allocate(size_t n, size_t align)
+  {
+    char * q=reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(p)+align-1) & ~(uintptr_t)(align-1));
+    while (p == NULL || q+n > e) // next block, reused or new
+    {
+      if (p != NULL) cur++;
+      if (cur == blocks.size())
+      {
+        size_t s=max(blocksize,n+align);
+        blocks.push_back(make_pair(static_cast<char *>(::operator new(s)),s));
+      }
+      p=blocks[cur].first; e=p+blocks[cur].second;
+      q=reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(p)+align-1) & ~(uintptr_t)(align-1));
+    }
+    p=q+n;
+    return q;
+  }
+
+  void reset() // Forget all objects, keep the blocks
+  {
+    cur=0; 
+    p = blocks.empty() ? NULL : blocks[0].first;
+    e = blocks.empty() ? NULL : p+blocks[0].second;
+  }
+
+  void release() // Forget all objects, free the blocks
+  {
+    for (auto & b : blocks) ::operator delete(b.first);
+    blocks.clear();
+    cur=0; p=e=NULL;
+  }
+
+  size_t reserved() const
+  {
+    size_t n=0;
+    for (const auto & b : blocks) n+=b.second;
+    return n;
+  }
+
+  // Arena picked up by default constructed arena allocators, in this thread
+  static arena *& current()
+  {
+    static thread_local arena * a=NULL;
+    return a;
+  }
+
+  class scope // Makes an arena current, while in scope
+  {
+    arena * prev;
+  public:
+    scope(arena & a) : prev(current()) { current()=&a; }
+    ~scope() { current()=prev; }
+  };
+};
+
+// Allocates from the arena that was current when it was made, or from 
+// the heap if none was. Containers keep their arena when assigned to, so
+// deltas can be built in an arena and joined into long lived replicas
+template<typename T>
+class arenaallocator
+{
+public:
+  typedef T value_type;
+  arena * a;
+
+  arenaallocator() : a(arena::current()) {}
+  arenaallocator(arena & ar) : a(&ar) {}
+  template<typename U> 
+  arenaallocator(const arenaallocator<U> & o) : a(o.a) {}
+
+  T * allocate(size_t n)
+  {
+    if (a == NULL) return static_cast<T *>(::operator new(n*sizeof(T)));
+    return static_cast<T *>(a->allocate(n*sizeof(T),alignof(T)));
+  }
+
+  void deallocate(T * p, size_t)
+  {
+    if (a == NULL) ::operator delete(p);
+  }
+
+  // Copies are made where the copy is, not where the original was
+  arenaallocator<T> select_on_container_copy_construction() const
+  {
+    return arenaallocator<T>();
+  }
+
+  template<typename U> 
+  bool operator==(const arenaallocator<U> & o) const { return a == o.a; }
+  template<typename U> 
+  bool operator!=(const arenaallocator<U> & o) const { return a != o.a; }
+};
+
+// Containers made inside others, such as map values, must use the arena 
+// of the outer one, not the current one. While in scope, it is current
+template<typename L> 
+struct allocscope 
+{ 
+  allocscope(const L &) {} // Other allocators have no arena
+};
+
+template<typename T> 
+struct allocscope<arenaallocator<T> > 
+{
+  arena * prev;
+  allocscope(const arenaallocator<T> & l) : prev(arena::current()) 
+  { 
+    arena::current()=l.a; 
+  }
+  ~allocscope() { arena::current()=prev; }
+};
+
+// Pools of fixed size blocks, with free lists, one per block size and 
+// thread. Suits long lived replicas, where nodes are often freed and
+// reallocated. Pool memory is kept for reuse and never given back.
+class pool
+{
+private:
+  struct node { node * next; };
+  node * free=NULL;
+  size_t size;
+
+public:
+  pool(size_t s) : size(max(s,sizeof(node))) {}
+
+  void * allocate()
+  {
+    if (free == NULL) // carve a new chunk
+    {
+      const size_t per=max<size_t>(1,64*1024/size);
+      char * c=static_cast<char *>(::operator new(per*size));
+      for (size_t i=0; i < per; i++) 
+      {
+        node * n=reinterpret_cast<node *>(c+i*size);
+        n->next=free; free=n;
+      }
+    }
+    node * n=free;
+    free=n->next;
+    return n;
+  }
+
+  void deallocate(void * q)
+  {
+    node * n=static_cast<node *>(q);
+    n->next=free; free=n;
+  }
+
+  static const size_t step=16, largest=256; // Sizes with pools
+
+  static pool & of(size_t s) // The pool for blocks of s bytes
+  {
+    static thread_local vector<pool> * pools=NULL;
+    if (pools == NULL) 
+    {
+      pools=new vector<pool>(); // one per thread, kept for its blocks
+      for (size_t b=step; b <= largest; b+=step) pools->push_back(pool(b));
+    }
+    return (*pools)[(s+step-1)/step-1];
+  }
+};
+
+template<typename T>
+class poolallocator
+{
+public:
+  typedef T value_type;
+
+  poolallocator() {}
+  template<typename U> poolallocator(const poolallocator<U> &) {}
+
+  T * allocate(size_t n)
+  {
+    if (n != 1 || sizeof(T) > pool::largest) 
+      return static_cast<T *>(::operator new(n*sizeof(T)));
+    return static_cast<T *>(pool::of(sizeof(T)).allocate());
+  }
+
+  void deallocate(T * p, size_t n)
+  {
+    if (n != 1 || sizeof(T) > pool::largest) 
+      ::operator delete(p);
+    else
+      pool::of(sizeof(T)).deallocate(p);
+  }
+
+  template<typename U> 
+  bool operator==(const poolallocator<U> &) const { return true; }
+  template<typename U> 
+  bool operator!=(const poolallocator<U> &) const { return false; }
+};
+
+template<typename K> class dotcontextview;
+
+// Autonomous causal context, for context sharing in maps
+template<typename K, template<typename> class A=allocator>
+class dotcontext
+{
+public:
+  typedef set<pair<K,int>,less<pair<K,int> >,A<pair<K,int> > > dcset;
+  template<typename U> using alloc = A<U>; // For containers sharing it
+
+  map<K,int,less<K>,A<pair<const K,int> > > cc; // Compact causal context
+  dcset dc; // Dot cloud
+  bool deferred=false; // Compaction is left for later, see defer
+  bool held=false; // Joins are left to the owner, see hold
+  // Changes of the states over this context, as dots made and joins that 
+  // covered new dots or dropped and merged stored ones. Not copied with 
+  // the context
+  atomic<size_t> changes{0};
+
+  dotcontext() {}
+  dotcontext(const dotcontext<K,A> & o) : cc(o.cc), dc(o.dc) {}
+  dotcontext(dotcontext<K,A> && o) : cc(std::move(o.cc)), dc(std::move(o.dc)) {}
+
+  dotcontext<K,A> & operator=(const dotcontext<K,A> & o)
+  {
+    if (&o == this) return *this;
+    cc=o.cc; dc=o.dc;
+    return *this;
+  }
+
+  dotcontext<K,A> & operator=(dotcontext<K,A> && o)
+  {
+    if (&o == this) return *this;
+    cc=std::move(o.cc); dc=std::move(o.dc);
+    return *this;
+  }
+
+  friend ostream &operator<<( ostream &output, const dotcontext<K,A>& o)
+  { 
+    output << "Context:";
+    output << " CC ( ";
+    for (const auto & ki : o.cc)
+      output << ki.first << ":" << ki.second << " ";
+    output << ")";
+    output << " DC ( ";
+    for (const auto & ki : o.dc)
+      output << ki.first << ":" << ki.second << " ";
+    output << ")";
+    return output;            
+  }
+
+  bool dotin (const pair<K,int> & d) const
+  {
+    const auto itm = cc.find(d.first);
+    if (itm != cc.end() && d.second <= itm->second) return true;
+    if (dc.count(d)!=0) return true;
+    return false;
+  }
+
+  void compact()
+  {
+    // Compact DC to CC if possible
+    // DC is ordered by id and then by counter, so the dots of each id form 
+    // a sorted run that can be absorbed into CC in a single pass
+    for(auto sit = dc.begin(); sit != dc.end();)
+    {
+      const K id=sit->first;
+      sit=compactrun(sit);
+      while (sit != dc.end() && sit->first == id) // skip the gapped dots
+        ++sit;
+    }
+  }
+
+  void compact(const K & id) // Compact only the dots of a given id
+  {
+    auto sit=dc.lower_bound(pair<K,int>(id,numeric_limits<int>::min()));
+    if (sit != dc.end() && sit->first == id)
+      compactrun(sit);
+  }
+
+  // Absorb into CC the dots of a run that are contiguous to, or dominated 
+  // by, the CC entry of that id. Returns the position after the absorbed ones
+  typename dcset::iterator compactrun(typename dcset::iterator sit)
+  {
+    const K id=sit->first;
+    auto mit=cc.find(id);
+    int top = (mit == cc.end()) ? 0 : mit->second;
+    auto first=sit;
+    while (sit != dc.end() && sit->first == id && sit->second <= top+1)
+    {
+      top=max(top,sit->second);
+      ++sit;
+    }
+    if (first == sit) return sit; // gap right at the start, nothing to do
+    if (mit == cc.end()) 
+      cc.insert(pair<K,int>(id,top));
+    else
+      mit->second=top;
+    return dc.erase(first,sit);
+  }
+
+  // While deferred, joins and inserted dots leave the context uncompacted, 
+  // for batches of joins that compact once at the end. Dots are still
+  // answered by dotin, but no new dots should be made
+  void defer(bool on)
+  {
+    deferred=on;
+    if (! on) compact();
+  }
+
+  // While held, joins leave the context as it is. A map holds the context 
+  // shared by its values while joining them, so that each value is joined 
+  // against the context from before the join, and then joins it once
+  bool hold(bool on)
+  {
+    bool was=held;
+    if (was != on) held=on; // not written by the values of a parallel join
+    return was;
+  }
+
+  pair<K,int> makedot(const K & id)
+  {
+    // On a valid dot generator, all dots should be compact on the used id
+    // Making the new dot, updates the dot generator and returns the dot
+    // pair<typename map<K,int>::iterator,bool> ret;
+    auto kib=cc.insert(pair<K,int>(id,1));
+    if (kib.second==false) // already there, so update it
+      (kib.first->second)+=1;
+    changes++;
+    //return dot;
+    return pair<K,int>(*kib.first);
+  }
+
+  void insertdot(const pair<K,int> & d, bool compactnow=true)
+  {
+    // Set
+    dc.insert(d);
+    if (compactnow && ! deferred) compact(d.first);
+  }
+
+
+  void join (const dotcontext<K,A> & o)
+  {
+    if (this == &o || held) return; // Join is idempotent, but just dont do it.
+    // CC
+    //typename  map<K,int>::iterator mit;
+    //typename  map<K,int>::const_iterator mito;
+    bool grew=false;
+    auto mit=cc.begin(); auto mito=o.cc.begin();
+    do 
+    {
+      if (mit != cc.end() && (mito == o.cc.end() || mit->first < mito->first))
+      {
+        // cout << "cc one\n";
+        // entry only at here
+        ++mit;
+      }
+      else if (mito != o.cc.end() && (mit == cc.end() || mito->first < mit->first))
+      {
+        // cout << "cc two\n";
+        // entry only at other
+        cc.insert(mit,*mito);
+        ++mito;
+        grew=true;
+      }
+      else if ( mit != cc.end() && mito != o.cc.end() )
+      {
+        // cout << "cc three\n";
+        // in both
+        if (mito->second > mit->second) 
+        {
+          mit->second=mito->second;
+          grew=true;
+        }
+        ++mit; ++mito;
+      }
+    } while (mit != cc.end() || mito != o.cc.end());
+    // DC
+    // Set
+    for (const auto & e : o.dc)
+    {
+      if (! grew && ! dotin(e)) grew=true;
+      insertdot(e,false);
+    }
+    if (grew) changes++;
+    if (deferred) return;
+    // Only the runs of ids present in the other context can change
+    for (const auto & ki : o.cc)
+      compact(ki.first);
+    for (auto sit = o.dc.begin(); sit != o.dc.end(); ++sit)
+      if (sit == o.dc.begin() || prev(sit)->first != sit->first)
+        compact(sit->first);
+
+  }
+
+  void join (dotcontext<K,A> && o) // Takes over o, when this is empty
+  {
+    if (this == &o || held) return;
+    if (! cc.empty() || ! dc.empty() || 
+        cc.get_allocator() != o.cc.get_allocator() ||
+        dc.get_allocator() != o.dc.get_allocator())
+    {
+      join(o);
+      return;
+    }
+    cc.swap(o.cc); dc.swap(o.dc);
+    if (! cc.empty() || ! dc.empty()) changes++;
+    if (o.deferred && ! deferred) compact();
+  }
+
+  void join (const dotcontextview<K> & o)
+  {
+    if (held) return;
+    bool grew=false;
+    o.eachcc([this,&grew](const K & id, int n)
+    {
+      auto kib=cc.insert(pair<K,int>(id,n));
+      if (kib.second) 
+        grew=true;
+      else if (n > kib.first->second)
+      {
+        kib.first->second=n;
+        grew=true;
+      }
+      if (! deferred) compact(id);
+    });
+    size_t budget=wiremaxcloud; // as checked by the view
+    o.eachrun([this,&budget,&grew](const K & id, int first, int last)
+    {
+      insertrun(id,first,last,budget,&grew);
+      if (! deferred) compact(id);
+    });
+    if (grew) changes++;
+  }
+
+  // Inserts the dots first..last of id. The part of the run that continues 
+  // the compact entry of id extends it, the rest goes to the cloud if it 
+  // fits in the budget of cloud dots, and false is returned otherwise. 
+  // Sets grew when some dot was not known before
+  bool insertrun(const K & id, int first, int last, size_t & budget, 
+    bool * grew=NULL)
+  {
+    auto mit=cc.find(id);
+    int top = mit == cc.end() ? 0 : mit->second;
+    if (first <= static_cast<long long>(top)+1)
+    {
+      if (last <= top) return true;
+      if (mit == cc.end()) 
+        cc.insert(pair<K,int>(id,last));
+      else
+        mit->second=last;
+      if (grew) *grew=true;
+      return true;
+    }
+    size_t n=static_cast<size_t>(static_cast<long long>(last)-first)+1;
+    if (n > budget) return false;
+    budget-=n;
+    for (int i=first;; i++) // last may be the largest int
+    {
+      pair<K,int> d(id,i);
+      if (grew && ! *grew && dc.count(d) == 0) *grew=true;
+      dc.insert(dc.end(),d);
+      if (i == last) break;
+    }
+    return true;
+  }
+
+  // Wire encoding, CC entries and then the DC of each id as runs of dots
+  void encode(wireout & w) const
+  {
+    w.uvarint(cc.size());
+    for (const auto & ki : cc)
+    {
+      w.id(ki.first);
+      ::encode(w,ki.second);
+    }
+    size_t ids=0;
+    for (auto sit = dc.begin(); sit != dc.end(); ++sit)
+      if (sit == dc.begin() || prev(sit)->first != sit->first) ids++;
+    w.uvarint(ids);
+    for (auto sit = dc.begin(); sit != dc.end();)
+    {
+      size_t runs=0;
+      auto end=sit; 
+      for (; end != dc.end() && end->first == sit->first; ++end)
+        if (end == sit || prev(end)->second+1 != end->second) runs++;
+      w.id(sit->first);
+      w.uvarint(runs);
+      int last=0;
+      while (sit != end)
+      {
+        int first=sit->second;
+        for (++sit; sit != end && sit->second == prev(sit)->second+1;) 
+          ++sit;
+        ::encode(w,first-last); // gap from the previous run
+        w.uvarint(prev(sit)->second-first); // run length, minus one
+        last=prev(sit)->second;
+      }
+    }
+  }
+
+  void decode(wirein & r)
+  {
+    cc.clear(); dc.clear();
+    // Ids come in increasing order, and so do the runs of each id
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      pair<K,int> ki;
+      r.id(ki.first);
+      ::decode(r,ki.second);
+      if (! cc.empty() && ! (cc.rbegin()->first < ki.first)) r.fail();
+      if (r.good()) cc.insert(cc.end(),ki);
+    }
+    size_t budget=wiremaxcloud;
+    pair<K,int> d; bool any=false;
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      K prev=d.first;
+      r.id(d.first);
+      if (any && ! (prev < d.first)) r.fail();
+      int first, last=0;
+      for (size_t runs=r.count(), i=0; i < runs && r.run(last,first); i++)
+        if ((i > 0 && first <= d.second) || 
+            ! insertrun(d.first,first,last,budget)) 
+          r.fail();
+        else 
+          d.second=last;
+      any=true;
+    }
+    compact();
+  }
+};
+
+// Holds a context while in scope, see dotcontext::hold. The previous state
+// is restored also when a join inside throws
+template<typename C>
+struct holdscope
+{
+  C & c;
+  bool was; // held by an enclosing scope
+  holdscope(C & ctx) : c(ctx), was(ctx.hold(true)) {}
+  ~holdscope() { c.hold(was); }
+};
+
+// Read-only view of an encoded dotcontext, that is merged without decoding 
+// it into a dotcontext. The encoding is validated when the view is built.
+template<typename K>
+class dotcontextview
+{
+  wirein cc0; // at the compact entries
+  wirein dc0; // at the dot cloud
+
+public:
+  dotcontextview(wirein & r) : cc0(r), dc0(r)
+  {
+    K id, prev; int n;
+    for (size_t ids=r.count(), i=0; i < ids && r.good(); i++)
+    {
+      r.id(id); ::decode(r,n);
+      if (i > 0 && ! (prev < id)) r.fail(); // the cursor walks them in order
+      prev=id;
+    }
+    dc0=r;
+    // Runs that continue the compact entry of their id join as a range, 
+    // the others are bounded as in decode
+    wirein c=cc0;
+    size_t ccleft=c.count(), budget=wiremaxcloud;
+    pair<K,int> e; bool have=false;
+    eachrun(r,[&](const K & rid, int first, int last)
+    {
+      for (; ccleft > 0 && (! have || e.first < rid); ccleft--, have=true)
+      {
+        c.id(e.first); ::decode(c,e.second);
+      }
+      int top = have && e.first == rid ? e.second : 0;
+      if (first <= static_cast<long long>(top)+1) return;
+      size_t dots=static_cast<size_t>(static_cast<long long>(last)-first)+1;
+      if (dots > budget) r.fail(); else budget-=dots;
+    });
+  }
+
+  template<typename F> // Call f(id,n) for each compact entry, ordered by id
+  void eachcc(F f) const
+  {
+    wirein r=cc0;
+    pair<K,int> ki;
+    for (size_t ids=r.count(); ids > 0 && r.good(); ids--)
+    {
+      r.id(ki.first); ::decode(r,ki.second);
+      if (r.good()) f(ki.first,ki.second);
+    }
+  }
+
+  template<typename F> // Call f(id,first,last) for each run in the cloud
+  void eachrun(F f) const
+  {
+    wirein r=dc0;
+    eachrun(r,f);
+  }
+
+  // Answers if dots are in the context, for dots given in increasing order, 
+  // as in the merge walks of joins
+  class cursor
+  {
+    wirein cr, dr;
+    size_t ccleft, dcleft, runsleft;
+    bool ccvalid, dcvalid;
+    pair<K,int> cce; // current compact entry
+    K dcid; int first, last; // current run in the cloud
+
+    void nextcc()
+    {
+      ccvalid = ccleft > 0;
+      if (! ccvalid) return;
+      ccleft--;
+      cr.id(cce.first); ::decode(cr,cce.second);
+    }
+
+    void nextrun()
+    {
+      while (runsleft == 0 && dcleft > 0) // next id
+      {
+        dcleft--;
+        dr.id(dcid);
+        runsleft=dr.count();
+        last=0;
+      }
+      dcvalid = runsleft > 0;
+      if (! dcvalid) return;
+      runsleft--;
+      dr.run(last,first);
+    }
+
+  public:
+    cursor(const dotcontextview<K> & v) : cr(v.cc0), dr(v.dc0), runsleft(0)
+    {
+      ccleft=cr.count(); 
+      dcleft=dr.count(); 
+      nextcc(); nextrun();
+    }
+
+    bool dotin(const pair<K,int> & d)
+    {
+      while (ccvalid && cce.first < d.first) nextcc();
+      if (ccvalid && cce.first == d.first && d.second <= cce.second) 
+        return true;
+      while (dcvalid && (dcid < d.first || (dcid == d.first && last < d.second)))
+        nextrun();
+      return dcvalid && dcid == d.first && first <= d.second;
+    }
+  };
+
+  bool dotin(const pair<K,int> & d) const // Scans the encoding
+  {
+    return cursor(*this).dotin(d);
+  }
+
+private:
+  template<typename F> // Fails unless ids and their runs increase
+  static void eachrun(wirein & r, F f)
+  {
+    K id, prev;
+    for (size_t ids=r.count(), i=0; i < ids && r.good(); i++)
+    {
+      r.id(id);
+      if (i > 0 && ! (prev < id)) r.fail();
+      prev=id;
+      int first, last=0;
+      for (size_t runs=r.count(), j=0; j < runs; j++)
+      {
+        int end=last;
+        if (! r.run(last,first)) return;
+        if (j > 0 && first <= end) { r.fail(); return; }
+        f(id,first,last);
+      }
+    }
+  }
+};
+
+// Read-only view of an encoded dotkernel, with its own context, that 
+// can be joined into a kernel without decoding it. 
+template<typename T, typename K>
+class dotkernelview
+{
+public:
+  dotcontextview<K> c;
+
+private:
+  wirein ds0; // at the dot store
+
+public:
+  dotkernelview(wirein & r) : c(r), ds0(r)
+  {
+    each(r,[](const pair<K,int> &, const T &){});
+  }
+
+  template<typename F> // Call f(dot,val) for each dot in increasing order
+  void each(F f) const
+  {
+    wirein r=ds0;
+    each(r,f);
+  }
+
+private:
+  template<typename F>
+  static void each(wirein & r, F f)
+  {
+    pair<K,int> dot; T val;
+    pair<K,int> prev; bool first=true; // dots must come ordered
+    for (size_t ids=r.count(); ids > 0 && r.good(); ids--)
+    {
+      r.id(dot.first);
+      int last=0;
+      for (size_t dots=r.count(); dots > 0 && r.next(last); dots--)
+      {
+        dot.second=last;
+        ::decode(r,val);
+        if (! first && ! (prev < dot)) r.fail();
+        if (! r.good()) return;
+        f(static_cast<const pair<K,int> &>(dot),static_cast<const T &>(val));
+        prev=dot; first=false;
+      }
+    }
+  }
+};
+
+// Sorted vector with a map like interface, usable as a flat dot store. 
+// Entries are kept contiguous, so merges are cache friendly linear walks, 
+// but inserting out of order is linear in the store size.
+template<typename Key, typename T>
+class flatmap
+{
+public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef pair<Key,T> value_type;
+  typedef typename vector<value_type>::iterator iterator;
+  typedef typename vector<value_type>::const_iterator const_iterator;
+
+private:
+  vector<value_type> v;
+
+  static bool keyless(const value_type & e, const Key & k) 
+  { 
+    return e.first < k; 
+  }
+
+public:
+  iterator begin() { return v.begin(); }
+  iterator end() { return v.end(); }
+  const_iterator begin() const { return v.begin(); }
+  const_iterator end() const { return v.end(); }
+  size_t size() const { return v.size(); }
+  bool empty() const { return v.empty(); }
+  void clear() { v.clear(); }
+  void reserve(size_t n) { v.reserve(n); }
+  void swap(flatmap<Key,T> & o) { v.swap(o.v); }
+  typename vector<value_type>::allocator_type get_allocator() const 
+  { 
+    return v.get_allocator(); 
+  }
+
+  bool operator == ( const flatmap<Key,T>& o ) const { return v==o.v; }
+
+  iterator lower_bound(const Key & k)
+  {
+    return std::lower_bound(v.begin(),v.end(),k,keyless);
+  }
+
+  const_iterator lower_bound(const Key & k) const
+  {
+    return std::lower_bound(v.begin(),v.end(),k,keyless);
+  }
+
+  iterator find(const Key & k)
+  {
+    auto it=lower_bound(k);
+    if (it != v.end() && it->first == k) return it;
+    return v.end();
+  }
+
+  const_iterator find(const Key & k) const
+  {
+    auto it=lower_bound(k);
+    if (it != v.end() && it->first == k) return it;
+    return v.end();
+  }
+
+  size_t count(const Key & k) const 
+  { 
+    return find(k) == v.end() ? 0 : 1; 
+  }
+
+  pair<iterator,bool> insert(const value_type & e)
+  {
+    auto it=lower_bound(e.first);
+    if (it != v.end() && it->first == e.first) 
+      return pair<iterator,bool>(it,false);
+    return pair<iterator,bool>(v.insert(it,e),true);
+  }
+
+  iterator insert(const_iterator hint, const value_type & e)
+  {
+    // Appending in order is the common case when building a store
+    if (hint == v.end() && (v.empty() || v.back().first < e.first))
+    {
+      v.push_back(e);
+      return v.end()-1;
+    }
+    return insert(e).first;
+  }
+
+  // Append assuming the caller keeps the order, as in merge walks
+  void push_back(const value_type & e) { v.push_back(e); }
+  void push_back(value_type && e) { v.push_back(std::move(e)); }
+
+  iterator erase(iterator it) { return v.erase(it); }
+
+  size_t erase(const Key & k)
+  {
+    auto it=find(k);
+    if (it == v.end()) return 0;
+    v.erase(it);
+    return 1;
+  }
+};
+
+template<typename D> // Stores that are merged by rebuilding them in order
+struct isflat : false_type {};
+
+template<typename Key, typename T>
+struct isflat<flatmap<Key,T> > : true_type {};
+
+// Open addressing hash set with linear probing and a set like interface, 
+// for element sets that are never read in order. Erased elements leave 
+// tombstones until the table is rebuilt. Printing and encoding are sorted, 
+// so they do not depend on the insertion history
+template<typename T, template<typename> class A=allocator, typename H=hash<T> >
+class hashset
+{
+public:
+  typedef T key_type;
+  typedef T value_type;
+
+  class iterator // Walks the full slots, elements are not mutable
+  {
+    const hashset<T,A,H> * h;
+    size_t i;
+
+    void skip() { while (i < h->v.size() && h->st[i] != full) i++; }
+
+  public:
+    typedef forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const T * pointer;
+    typedef const T & reference;
+
+    iterator(const hashset<T,A,H> * s, size_t j) : h(s), i(j) { skip(); }
+    const T & operator*() const { return h->v[i]; }
+    const T * operator->() const { return &h->v[i]; }
+    iterator & operator++() { i++; skip(); return *this; }
+    iterator operator++(int) { iterator r=*this; ++*this; return r; }
+    bool operator==(const iterator & o) const { return i == o.i; }
+    bool operator!=(const iterator & o) const { return i != o.i; }
+  };
+  typedef iterator const_iterator;
+
+private:
+  enum : unsigned char { vacant=0, full=1, gone=2 }; // slot states
+  vector<T,A<T> > v;
+  vector<unsigned char,A<unsigned char> > st; // apart, so probes mostly read bytes
+  size_t n=0; // elements
+  size_t used=0; // full and gone slots, at most half of the table
+  int shift=64;
+
+  size_t slot(const T & e) const // Fibonacci hashing, spreads sequential keys
+  {
+    return (static_cast<uint64_t>(H()(e))*0x9E3779B97F4A7C15ULL) >> shift;
+  }
+
+  size_t probe(const T & e) const // slot of e, or the table size if absent
+  {
+    if (n == 0) return v.size();
+    size_t mask=v.size()-1;
+    for (size_t i=slot(e); ; i=(i+1)&mask)
+    {
+      if (st[i] == vacant) return v.size();
+      if (st[i] == full && v[i] == e) return i;
+    }
+  }
+
+  void rehash(size_t want) // room for want elements at half load
+  {
+    size_t cap=4; // small, as deltas are often a single element
+    int s=62;
+    while (cap < 2*want) { cap*=2; s--; }
+    vector<T,A<T> > ov(cap);
+    vector<unsigned char,A<unsigned char> > ost(cap,vacant);
+    ov.swap(v); ost.swap(st);
+    shift=s; used=n;
+    size_t mask=cap-1;
+    for (size_t j=0; j < ov.size(); j++)
+      if (ost[j] == full)
+      {
+        size_t i=slot(ov[j]);
+        while (st[i] != vacant) i=(i+1)&mask;
+        v[i]=std::move(ov[j]); st[i]=full;
+      }
+  }
+
+  vector<const T *> sorted() const
+  {
+    vector<const T *> r;
+    r.reserve(n);
+    for (const auto & e : *this) r.push_back(&e);
+    sort(r.begin(),r.end(),[](const T * a, const T * b) { return *a < *b; });
+    return r;
+  }
+
+public:
+  hashset() {}
+  hashset(initializer_list<T> l) { insert(l.begin(),l.end()); }
+
+  iterator begin() const { return iterator(this,0); }
+  iterator end() const { return iterator(this,v.size()); }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  void clear() { v.clear(); st.clear(); n=0; used=0; shift=64; }
+
+  void reserve(size_t k) 
+  { 
+    if (2*k > v.size()) rehash(max(k,n)); 
+  }
+
+  bool operator == ( const hashset<T,A,H>& o ) const 
+  { 
+    if (n != o.n) return false;
+    for (const auto & e : *this) 
+      if (o.count(e) == 0) return false;
+    return true;
+  }
+
+  bool operator != ( const hashset<T,A,H>& o ) const { return !(*this == o); }
+
+  iterator find(const T & e) const { return iterator(this,probe(e)); }
+
+  size_t count(const T & e) const { return probe(e) == v.size() ? 0 : 1; }
+
+  pair<iterator,bool> insert(const T & e)
+  {
+    if (2*(used+1) > v.size()) rehash(2*(n+1)); // grow, or drop tombstones
+    size_t mask=v.size()-1, at=v.size();
+    for (size_t i=slot(e); ; i=(i+1)&mask)
+    {
+      if (st[i] == full)
+      {
+        if (v[i] == e) return pair<iterator,bool>(iterator(this,i),false);
+      }
+      else 
+      {
+        if (at == v.size()) at=i; // first reusable slot
+        if (st[i] == vacant) break;
+      }
+    }
+    if (st[at] == vacant) used++;
+    v[at]=e; st[at]=full; n++;
+    return pair<iterator,bool>(iterator(this,at),true);
+  }
+
+  iterator insert(const_iterator, const T & e) { return insert(e).first; }
+
+  template<typename It> // Bulk insert, sizing the table once
+  void insert(It first, It last)
+  {
+    reserve(n+distance(first,last));
+    for (; first != last; ++first) insert(*first);
+  }
+
+  size_t erase(const T & e)
+  {
+    size_t i=probe(e);
+    if (i == v.size()) return 0;
+    v[i]=T(); st[i]=gone; n--;
+    return 1;
+  }
+
+  friend ostream &operator<<( ostream &output, const hashset<T,A,H>& o)
+  { 
+    output << "( ";
+    for (const T * e : o.sorted()) output << *e << " ";
+    output << ")";
+    return output;
+  }
+
+  void encode(wireout & w) const
+  {
+    w.uvarint(n);
+    for (const T * e : sorted()) ::encode(w,*e);
+  }
+
+  void decode(wirein & r)
+  {
+    clear();
+    size_t k=r.count();
+    reserve(k);
+    for (; k > 0 && r.good(); k--)
+    {
+      T e;
+      ::decode(r,e);
+      insert(e);
+    }
+  }
+};
+
+// Insert only set for the tombstones of churn heavy twopsets. Elements are
+// kept exactly in sorted runs, merged like a binary counter, and a blocked
+// Bloom filter (six bits in one word per element) answers most lookups of 
+// absent elements without searching the runs
+template<typename T, template<typename> class A=allocator, typename H=hash<T> >
+class bloomset
+{
+public:
+  typedef T key_type;
+  typedef T value_type;
+  typedef vector<T,A<T> > run;
+
+  class iterator // Walks the runs in turn, not in element order
+  {
+    const bloomset<T,A,H> * b;
+    size_t r, i;
+
+    void skip() { while (r < b->runs.size() && i == b->runs[r].size()) { r++; i=0; } }
+
+  public:
+    typedef forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const T * pointer;
+    typedef const T & reference;
+
+    iterator(const bloomset<T,A,H> * s, size_t q) : b(s), r(q), i(0) { skip(); }
+    const T & operator*() const { return b->runs[r][i]; }
+    const T * operator->() const { return &b->runs[r][i]; }
+    iterator & operator++() { i++; skip(); return *this; }
+    iterator operator++(int) { iterator o=*this; ++*this; return o; }
+    bool operator==(const iterator & o) const { return r == o.r && i == o.i; }
+    bool operator!=(const iterator & o) const { return !(*this == o); }
+  };
+  typedef iterator const_iterator;
+
+private:
+  vector<run> runs; // each run is larger than the ones after it
+  vector<uint64_t,A<uint64_t> > bits;
+  size_t n=0;
+
+  static uint64_t mix(const T & e) // all bits of the hash depend on all bits
+  {
+    uint64_t h=H()(e);
+    h^=h >> 33; h*=0xff51afd7ed558ccdULL;
+    h^=h >> 33; h*=0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+
+  size_t word(uint64_t h) const { return (h >> 36) & (bits.size()-1); }
+
+  static uint64_t bitmask(uint64_t h) // six bits, from the low 36 of h
+  {
+    uint64_t m=0;
+    for (int i=0; i < 36; i+=6) m|=uint64_t(1) << ((h >> i) & 63);
+    return m;
+  }
+
+  void mark(const T & e)
+  {
+    uint64_t h=mix(e);
+    bits[word(h)]|=bitmask(h);
+  }
+
+  void refilter(size_t want) // 16 bits per element, for want elements
+  {
+    size_t words=1;
+    while (words*4 < want) words*=2;
+    bits.assign(words,0);
+    for (const auto & e : *this) mark(e);
+  }
+
+  run sorted() const // all elements, merged into one run
+  {
+    run all;
+    all.reserve(n);
+    for (const auto & r : runs) 
+    {
+      size_t mid=all.size();
+      all.insert(all.end(),r.begin(),r.end());
+      inplace_merge(all.begin(),all.begin()+mid,all.end());
+    }
+    return all;
+  }
+
+public:
+  bloomset() {}
+  bloomset(initializer_list<T> l) { insert(l.begin(),l.end()); }
+
+  iterator begin() const { return iterator(this,0); }
+  iterator end() const { return iterator(this,runs.size()); }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  void clear() { runs.clear(); bits.clear(); n=0; }
+
+  void reserve(size_t k)
+  {
+    if (k > bits.size()*4) refilter(max(k,n));
+  }
+
+  bool operator == ( const bloomset<T,A,H>& o ) const 
+  { 
+    if (n != o.n) return false;
+    for (const auto & e : *this) 
+      if (o.count(e) == 0) return false;
+    return true;
+  }
+
+  bool operator != ( const bloomset<T,A,H>& o ) const { return !(*this == o); }
+
+  size_t count(const T & e) const
+  {
+    if (n == 0) return 0;
+    uint64_t h=mix(e), m=bitmask(h);
+    if ((bits[word(h)] & m) != m) return 0; // surely absent
+    for (const auto & r : runs)
+      if (binary_search(r.begin(),r.end(),e)) return 1;
+    return 0;
+  }
+
+  bool insert(const T & e)
+  {
+    if (count(e)) return false;
+    if (n+1 > bits.size()*4) refilter(2*(n+1)); // grow the filter
+    mark(e);
+    runs.push_back(run(1,e));
+    n++;
+    while (runs.size() > 1 && runs[runs.size()-2].size() <= runs.back().size())
+    {
+      run & l=runs[runs.size()-2];
+      size_t mid=l.size();
+      l.insert(l.end(),runs.back().begin(),runs.back().end());
+      inplace_merge(l.begin(),l.begin()+mid,l.end());
+      runs.pop_back();
+    }
+    return true;
+  }
+
+  bool insert(const_iterator, const T & e) { return insert(e); }
+
+  template<typename It> // Bulk insert, sizing the filter once
+  void insert(It first, It last)
+  {
+    reserve(n+distance(first,last));
+    for (; first != last; ++first) insert(*first);
+  }
+
+  friend ostream &operator<<( ostream &output, const bloomset<T,A,H>& o)
+  { 
+    output << "( ";
+    for (const auto & e : o.sorted()) output << e << " ";
+    output << ")";
+    return output;
+  }
+
+  void encode(wireout & w) const
+  {
+    w.uvarint(n);
+    for (const auto & e : sorted()) ::encode(w,e);
+  }
+
+  void decode(wirein & r)
+  {
+    clear();
+    run all;
+    for (size_t k=r.count(); k > 0 && r.good(); k--)
+    {
+      all.push_back(T());
+      ::decode(r,all.back());
+    }
+    sort(all.begin(),all.end());
+    all.erase(unique(all.begin(),all.end()),all.end());
+    n=all.size();
+    if (n > 0) runs.push_back(std::move(all));
+    refilter(n);
+  }
+};
+
+// Reserve room for n elements in sets that support it
+template<typename S> 
+auto presize(S & s, size_t n, int) -> decltype(s.reserve(n),void())
+{
+  s.reserve(n);
+}
+
+template<typename S> 
+void presize(S &, size_t, long) {} // trees grow a node at a time
+
+// Element set policies of gset and twopset, tombs are the removed ones
+struct setstore // Ordered tree set (default)
+{
+  template<typename T, template<typename> class A> 
+    using elems = set<T,less<T>,A<T> >;
+  template<typename T, template<typename> class A> 
+    using tombs = elems<T,A>;
+};
+
+struct hashstore // Open addressing hash set, for unordered element sets
+{
+  template<typename T, template<typename> class A> 
+    using elems = hashset<T,A>;
+  template<typename T, template<typename> class A> 
+    using tombs = elems<T,A>;
+};
+
+template<typename E=setstore> // Elements as in E, tombstones in a bloomset
+struct bloomstore : E
+{
+  template<typename T, template<typename> class A> 
+    using tombs = bloomset<T,A>;
+};
+
+// Storage policies for the dot store, value index and causal context of 
+// dotkernel, and for the datatypes that hold a kernel
+template<template<typename> class A> // One tree node per dot, allocated by A
+struct nodestore
+{
+  template<typename D, typename T> 
+    using store = map<D,T,less<D>,A<pair<const D,T> > >;
+  template<typename U> using alloc = A<U>;
+  template<typename K> using context = dotcontext<K,A>;
+};
+
+struct mapstore : nodestore<allocator> {}; // Cheap to update in place (default)
+struct arenastore : nodestore<arenaallocator> {}; // For deltas, see arena
+struct poolstore : nodestore<poolallocator> {}; // For long lived replicas
+
+struct flatstore // Contiguous sorted vector, compact and fast to merge 
+{
+  template<typename D, typename T> using store = flatmap<D,T>;
+  template<typename U> using alloc = allocator<U>;
+  template<typename K> using context = dotcontext<K>;
+};
+
+template<typename It> // The keys of a range of map entries, read in place
+class keyrange
+{
+  It b, e;
+  size_t n;
+
+public:
+  class iterator
+  {
+    It it;
+
+  public:
+    typedef forward_iterator_tag iterator_category;
+    typedef typename remove_const<
+      typename iterator_traits<It>::value_type::first_type>::type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const value_type * pointer;
+    typedef const value_type & reference;
+
+    iterator(It i) : it(i) {}
+    const value_type & operator*() const { return it->first; }
+    const value_type * operator->() const { return &it->first; }
+    iterator & operator++() { ++it; return *this; }
+    iterator operator++(int) { iterator r=*this; ++it; return r; }
+    bool operator==(const iterator & o) const { return it == o.it; }
+    bool operator!=(const iterator & o) const { return it != o.it; }
+  };
+
+  keyrange(It f, It l, size_t s) : b(f), e(l), n(s) {}
+  iterator begin() const { return iterator(b); }
+  iterator end() const { return iterator(e); }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+};
+
+// Index from payload values to the dots that currently hold them, so that
+// dots can be found by value without scanning the whole dot store
+template<typename T, typename K, template<typename> class A=allocator>
+class valueindex
+{
+  typedef set<pair<K,int>,less<pair<K,int> >,A<pair<K,int> > > dotset;
+  map<T,dotset,less<T>,A<pair<const T,dotset> > > vi;
+
+public:
+  void insert(const T & val, const pair<K,int> & dot)
+  {
+    allocscope<decltype(vi.get_allocator())> as(vi.get_allocator());
+    vi[val].insert(dot);
+  }
+
+  void erase(const T & val, const pair<K,int> & dot)
+  {
+    auto it=vi.find(val);
+    if (it == vi.end()) return;
+    it->second.erase(dot);
+    if (it->second.empty()) vi.erase(it);
+  }
+
+  void erase(const T & val) { vi.erase(val); }
+
+  void clear() { vi.clear(); }
+
+  const dotset * find(const T & val) const // NULL if no dots
+  {
+    auto it=vi.find(val);
+    if (it == vi.end()) return NULL;
+    return &it->second;
+  }
+
+  // Values that have dots, in order, with their dots
+  typedef typename map<T,dotset,less<T>,A<pair<const T,dotset> > >::const_iterator 
+    const_iterator;
+  const_iterator begin() const { return vi.begin(); }
+  const_iterator end() const { return vi.end(); }
+  size_t size() const { return vi.size(); }
+  bool empty() const { return vi.empty(); }
+
+  keyrange<const_iterator> values() const // just the values
+  {
+    return keyrange<const_iterator>(vi.begin(),vi.end(),vi.size());
+  }
+};
+
+template<typename T, typename K> // Stand-in when no index is kept
+class novalueindex
+{
+public:
+  void insert(const T &, const pair<K,int> &) {}
+  void erase(const T &, const pair<K,int> &) {}
+  void erase(const T &) {}
+  void clear() {}
+  bool empty() const { return true; }
+  const set<pair<K,int> > * find(const T &) const { return NULL; }
+};
+
+template<typename F> // Runs f(0) to f(n-1), each on a thread, f(n-1) on this one
+void inparallel(size_t n, F f)
+{
+  vector<exception_ptr> errs(n); // thrown by a part, rethrown here
+  auto run=[&](size_t i) { try { f(i); } catch (...) { errs[i]=current_exception(); } };
+  vector<thread> ts;
+  size_t i=0;
+  try
+  {
+    ts.reserve(n);
+    for (; i+1 < n; i++) ts.push_back(thread(run,i));
+  }
+  catch (...) {} // out of threads, the parts left run on this one
+  for (; i < n; i++) run(i);
+  for (auto & t : ts) t.join();
+  for (auto & e : errs) if (e) rethrow_exception(e);
+}
+
+// Allocators that threads can share. Arenas are not locked, and pools keep
+// a free list per thread that is never given back, so their values join here
+template<typename L> struct sharedalloc : false_type {};
+template<typename T> struct sharedalloc<allocator<T> > : true_type {};
+
+template <typename T, typename K, typename S=mapstore, bool VI=false>
+class dotkernel
+{
+public:
+
+  typedef typename S::template store<pair<K,int>,T> dotstore;
+  typedef typename S::template context<K> dotctx;
+
+  dotstore ds;  // Map of dots to vals
+
+  // Optional index from vals to their dots, only kept consistent when ds 
+  // is changed through the kernel operations
+  typename conditional<VI,valueindex<T,K,S::template alloc>,
+    novalueindex<T,K> >::type vi;
+
+  dotctx cbase;
+  dotctx & c;
+
+  // if no causal context supplied, used base one
+  dotkernel() : c(cbase) {} 
+  // if supplied, use a shared causal context
+  dotkernel(dotctx &jointc) : c(jointc) {} 
+  // copies keep using a shared context, but get their own base one 
+  dotkernel(const dotkernel<T,K,S,VI> &adk) : ds(adk.ds), vi(adk.vi), 
+    cbase(adk.cbase), c(&adk.c == &adk.cbase ? cbase : adk.c) {}
+  dotkernel(dotkernel<T,K,S,VI> &&adk) : ds(std::move(adk.ds)), 
+    vi(std::move(adk.vi)), cbase(std::move(adk.cbase)), 
+    c(&adk.c == &adk.cbase ? cbase : adk.c) {}
+
+  dotkernel<T,K,S,VI> & operator=(const dotkernel<T,K,S,VI> & adk)
+  {
+    if (&adk == this) return *this;
+    if (&c != &adk.c) c=adk.c; 
+    ds=adk.ds;
+    vi=adk.vi;
+    return *this;
+  }
+
+  dotkernel<T,K,S,VI> & operator=(dotkernel<T,K,S,VI> && adk)
+  {
+    if (&adk == this) return *this;
+    if (&c != &adk.c) 
+    {
+      if (&adk.c == &adk.cbase) // a shared context can not be moved away
+        c=std::move(adk.cbase);
+      else
+        c=adk.c; 
+    }
+    ds=std::move(adk.ds);
+    vi=std::move(adk.vi);
+    return *this;
+  }
+
+  friend ostream &operator<<( ostream &output, const dotkernel<T,K,S,VI>& o)
+  { 
+    output << "Kernel: DS ( ";
+    for (const auto & dv : o.ds)
+      output <<  dv.first.first << ":" << dv.first.second << 
+        "->" << dv.second << " ";
+    output << ") ";
+
+    output << o.c;
+
+    return output;            
+  }
+
+  void join (const dotkernel<T,K,S,VI> & o)
+  {
+    if (this == &o) return; // Join is idempotent, but just dont do it.
+    // DS
+    joinstore(o,false_type(),isflat<dotstore>());
+    // CC
+    c.join(o.c);
+  }
+
+  void deepjoin (const dotkernel<T,K,S,VI> & o)
+  {
+    if (this == &o) return; // Join is idempotent, but just dont do it.
+    // DS
+    joinstore(o,true_type(),isflat<dotstore>());
+    // CC
+    c.join(o.c);
+  }
+
+  // Kernels that are no longer needed are taken over by an empty kernel, 
+  // instead of copied. Without node splicing, others join as usual
+  void join (dotkernel<T,K,S,VI> && o)
+  {
+    if (! takeover(o)) join(o);
+  }
+
+  void deepjoin (dotkernel<T,K,S,VI> && o)
+  {
+    if (! takeover(o)) deepjoin(o);
+  }
+
+  // Joins of encoded kernels, walking the encoding in place
+  void join (const dotkernelview<T,K> & o)
+  {
+    joinview(o,false_type(),isflat<dotstore>());
+    c.join(o.c);
+  }
+
+  void deepjoin (const dotkernelview<T,K> & o)
+  {
+    joinview(o,true_type(),isflat<dotstore>());
+    c.join(o.c);
+  }
+
+  // Join of large states on a number of threads. The stores are cut in 
+  // ranges of dots, each range is compared on its own thread, and the 
+  // dots to import or remove are then changed in order, on this thread. 
+  // Flat stores, that are rebuilt by one linear merge, join as usual
+  void join (const dotkernel<T,K,S,VI> & o, unsigned threads)
+  {
+    if (threads <= 1 || this == &o) return join(o);
+    joinstore(o,threads,isflat<dotstore>());
+    c.join(o.c);
+  }
+
+private:
+
+  bool takeover(dotkernel<T,K,S,VI> & o)
+  {
+    if (this == &o || ! ds.empty() || ! c.cc.empty() || ! c.dc.empty()) 
+      return false;
+    if (ds.get_allocator() != o.ds.get_allocator()) // in another arena
+      return false;
+    ds.swap(o.ds);
+    vi=std::move(o.vi);
+    if (VI && vi.empty()) // deltas from add are not indexed, index them here
+      for (const auto & dv : ds) vi.insert(dv.second,dv.first);
+    if (&o.c == &o.cbase) 
+      c.join(std::move(o.cbase));
+    else
+      c.join(o.c);
+    return true;
+  }
+
+  // Dots in both sides only differ in payload if the payloads are mergeable
+  void joinpayload(const pair<K,int> &, T &, const T &, false_type) {}
+
+  void joinpayload(const pair<K,int> & dot, T & p, const T & op, true_type)
+  {
+    // check it payloads are diferent 
+    if (p != op)
+    {
+      // if payloads are not equal, they must be mergeable
+      // use the more general binary join
+      T q=::join(p,op);
+      if (q == p) return;
+      vi.erase(p,dot);
+      p=q;
+      vi.insert(p,dot);
+      c.changes++;
+    }
+  }
+
+  // Dots only imported are new to the context, so it counts those changes, 
+  // and the store counts the dots it drops
+
+  template<typename D> // Node based stores are updated in place
+  void joinstore (const dotkernel<T,K,S,VI> & o, D deep, false_type)
+  {
+    // will iterate over the two sorted sets to compute join
+    bool dropped=false;
+    auto it=ds.begin(); auto ito=o.ds.begin();
+    do 
+    {
+      if ( it != ds.end() && ( ito == o.ds.end() || it->first < ito->first))
+      {
+        // dot only at this
+        if (o.c.dotin(it->first)) // other knows dot, must delete here 
+        {
+          vi.erase(it->second,it->first);
+          it=ds.erase(it);
+          dropped=true;
+        }
+        else // keep it
+          ++it;
+      }
+      else if ( ito != o.ds.end() && ( it == ds.end() || ito->first < it->first))
+      {
+        // dot only at other
+        if(! c.dotin(ito->first)) // If I dont know, import
+        {
+          ds.insert(it,*ito);
+          vi.insert(ito->second,ito->first);
+        }
+        ++ito;
+      }
+      else if ( it != ds.end() && ito != o.ds.end() )
+      {
+        // dot in both
+        joinpayload(it->first,it->second,ito->second,deep);
+        ++it; ++ito;
+      }
+    } while (it != ds.end() || ito != o.ds.end() );
+    if (dropped) c.changes++;
+  }
+
+  template<typename D> // Flat stores are rebuilt by a single linear merge
+  void joinstore (const dotkernel<T,K,S,VI> & o, D deep, true_type)
+  {
+    dotstore res;
+    res.reserve(ds.size()+o.ds.size());
+    bool dropped=false;
+    auto it=ds.begin(); auto ito=o.ds.begin();
+    while (it != ds.end() || ito != o.ds.end())
+    {
+      if ( it != ds.end() && ( ito == o.ds.end() || it->first < ito->first))
+      {
+        // dot only at this, keep it unless other knows it
+        if (! o.c.dotin(it->first)) 
+          res.push_back(std::move(*it));
+        else
+        {
+          vi.erase(it->second,it->first);
+          dropped=true;
+        }
+        ++it;
+      }
+      else if ( ito != o.ds.end() && ( it == ds.end() || ito->first < it->first))
+      {
+        // dot only at other, import it if I dont know it
+        if(! c.dotin(ito->first)) 
+        {
+          res.push_back(*ito);
+          vi.insert(ito->second,ito->first);
+        }
+        ++ito;
+      }
+      else
+      {
+        // dot in both
+        joinpayload(it->first,it->second,ito->second,deep);
+        res.push_back(std::move(*it));
+        ++it; ++ito;
+      }
+    }
+    ds.swap(res);
+    if (dropped) c.changes++;
+  }
+
+  void joinstore (const dotkernel<T,K,S,VI> & o, unsigned threads, 
+    true_type flat)
+  {
+    joinstore(o,false_type(),flat);
+  }
+
+  void joinstore (const dotkernel<T,K,S,VI> & o, unsigned threads, 
+    false_type)
+  {
+    typedef typename dotstore::iterator iter;
+    typedef typename dotstore::const_iterator oiter;
+    size_t parts=threads;
+    // Ranges of equal size in the larger store, the same dots in the other
+    vector<iter> cut(1,ds.begin());
+    vector<oiter> ocut(1,o.ds.begin());
+    if (ds.size() >= o.ds.size())
+      for (size_t p=1; p < parts; p++)
+      {
+        iter it=cut.back();
+        advance(it,ds.size()/parts);
+        cut.push_back(it);
+        ocut.push_back(it == ds.end() ? o.ds.end() : o.ds.lower_bound(it->first));
+      }
+    else
+      for (size_t p=1; p < parts; p++)
+      {
+        oiter ito=ocut.back();
+        advance(ito,o.ds.size()/parts);
+        ocut.push_back(ito);
+        cut.push_back(ito == o.ds.end() ? ds.end() : ds.lower_bound(ito->first));
+      }
+    cut.push_back(ds.end()); ocut.push_back(o.ds.end());
+
+    // Dots to remove here, and dots to import with the entry they go before
+    vector<vector<iter> > drop(parts);
+    vector<vector<pair<iter,oiter> > > take(parts);
+    bool dropped=false;
+    inparallel(parts,[&](size_t p)
+    {
+      iter it=cut[p], end=cut[p+1];
+      oiter ito=ocut[p], oend=ocut[p+1];
+      while (it != end || ito != oend)
+      {
+        if (it != end && (ito == oend || it->first < ito->first))
+        {
+          if (o.c.dotin(it->first)) drop[p].push_back(it); // other knows dot
+          ++it;
+        }
+        else if (ito != oend && (it == end || ito->first < it->first))
+        {
+          if (! c.dotin(ito->first)) take[p].push_back(make_pair(it,ito));
+          ++ito;
+        }
+        else // dot in both, with equal payloads
+        {
+          ++it; ++ito;
+        }
+      }
+    });
+
+    // Inserts first, as they do not move the entries that are dropped
+    for (const auto & tp : take)
+      for (const auto & t : tp)
+      {
+        ds.insert(t.first,*t.second);
+        vi.insert(t.second->second,t.second->first);
+      }
+    for (const auto & dp : drop)
+      for (const auto & it : dp)
+      {
+        vi.erase(it->second,it->first);
+        ds.erase(it);
+        dropped=true;
+      }
+    if (dropped) c.changes++;
+  }
+
+  template<typename D> // As joinstore, with the other dots read in order
+  void joinview (const dotkernelview<T,K> & o, D deep, false_type)
+  {
+    typename dotcontextview<K>::cursor oc(o.c);
+    bool dropped=false;
+    auto it=ds.begin();
+    // dots only at this, until d, are kept unless other knows them
+    auto keepuntil = [&](const pair<K,int> * d)
+    {
+      while (it != ds.end() && (d == NULL || it->first < *d))
+      {
+        if (oc.dotin(it->first)) 
+        {
+          vi.erase(it->second,it->first);
+          it=ds.erase(it);
+          dropped=true;
+        }
+        else
+          ++it;
+      }
+    };
+    o.each([&](const pair<K,int> & d, const T & v)
+    {
+      keepuntil(&d);
+      if (it != ds.end() && it->first == d) // dot in both
+      {
+        joinpayload(it->first,it->second,v,deep);
+        ++it;
+      }
+      else if (! c.dotin(d)) // dot only at other, import if I dont know it
+      {
+        ds.insert(it,pair<pair<K,int>,T>(d,v));
+        vi.insert(v,d);
+      }
+    });
+    keepuntil(NULL);
+    if (dropped) c.changes++;
+  }
+
+  template<typename D>
+  void joinview (const dotkernelview<T,K> & o, D deep, true_type)
+  {
+    typename dotcontextview<K>::cursor oc(o.c);
+    dotstore res;
+    res.reserve(ds.size());
+    bool dropped=false;
+    auto it=ds.begin();
+    auto keepuntil = [&](const pair<K,int> * d)
+    {
+      for (; it != ds.end() && (d == NULL || it->first < *d); ++it)
+      {
+        if (! oc.dotin(it->first)) 
+          res.push_back(std::move(*it));
+        else
+        {
+          vi.erase(it->second,it->first);
+          dropped=true;
+        }
+      }
+    };
+    o.each([&](const pair<K,int> & d, const T & v)
+    {
+      keepuntil(&d);
+      if (it != ds.end() && it->first == d)
+      {
+        joinpayload(it->first,it->second,v,deep);
+        res.push_back(std::move(*it));
+        ++it;
+      }
+      else if (! c.dotin(d))
+      {
+        res.push_back(pair<pair<K,int>,T>(d,v));
+        vi.insert(v,d);
+      }
+    });
+    keepuntil(NULL);
+    ds.swap(res);
+    if (dropped) c.changes++;
+  }
+
+public:
+
+  dotkernel<T,K,S,VI> add (const K& id, const T& val) 
+  {
+    dotkernel<T,K,S,VI> res;
+    // get new dot
+    pair<K,int> dot=c.makedot(id);
+    // add under new dot
+    ds.insert(pair<pair<K,int>,T>(dot,val));
+    vi.insert(val,dot);
+    // make delta
+    res.ds.insert(pair<pair<K,int>,T>(dot,val));
+    res.c.insertdot(dot);
+    return res;
+  }
+
+  // Add that returns the added dot, instead of kernel delta
+  pair<K,int> dotadd (const K& id, const T& val)
+  {
+    // get new dot
+    pair<K,int> dot=c.makedot(id);
+    // add under new dot
+    ds.insert(pair<pair<K,int>,T>(dot,val));
+    vi.insert(val,dot);
+    return dot;
+  }
+
+  // Replace a dot by a new one with val, the delta only holds both dots
+  dotkernel<T,K,S,VI> replace (const pair<K,int>& old, const K& id, const T& val)
+  {
+    dotkernel<T,K,S,VI> res;
+    auto dsit=ds.find(old);
+    if (dsit != ds.end()) // found it
+    {
+      res.c.insertdot(dsit->first,false); // result knows removed dot
+      vi.erase(dsit->second,dsit->first);
+      ds.erase(dsit);
+    }
+    pair<K,int> dot=c.makedot(id);
+    ds.insert(pair<pair<K,int>,T>(dot,val));
+    vi.insert(val,dot);
+    res.ds.insert(pair<pair<K,int>,T>(dot,val));
+    res.c.insertdot(dot);
+    return res;
+  }
+
+  dotkernel<T,K,S,VI> rmv (const T& val)  // remove all dots matching value
+  {
+    dotkernel<T,K,S,VI> res;
+    if (VI) // The index knows exactly which dots to remove
+    {
+      auto dots=vi.find(val);
+      if (dots == NULL) return res;
+      for (const auto & dot : *dots)
+      {
+        res.c.insertdot(dot,false); // result knows removed dots
+        ds.erase(dot);
+      }
+      vi.erase(val);
+    }
+    else
+    {
+      for(auto dsit=ds.begin(); dsit != ds.end();)
+      {
+        if (dsit->second == val) // match
+        {
+          res.c.insertdot(dsit->first,false); // result knows removed dots
+          dsit=ds.erase(dsit);
+        }
+        else
+          ++dsit;
+      }
+    }
+    res.c.compact(); // Maybe several dots there, so atempt compactation
+    return res;
+  }
+
+  template<typename F> void eachdot (F f) const // each dot, in order
+  {
+    for (const auto & dv : ds) f(dv.first);
+  }
+
+  bool in (const T& val) const // is there any dot with a given value
+  {
+    if (VI) return vi.find(val) != NULL;
+    for (const auto & dv : ds)
+      if (dv.second == val) return true;
+    return false;
+  }
+
+  dotkernel<T,K,S,VI> rmv (const pair<K,int>& dot)  // remove a dot 
+  {
+    dotkernel<T,K,S,VI> res;
+    auto dsit=ds.find(dot);
+    if (dsit != ds.end()) // found it
+    {
+      res.c.insertdot(dsit->first,false); // result knows removed dots
+      vi.erase(dsit->second,dsit->first);
+      dsit=ds.erase(dsit);
+    }
+    res.c.compact(); // Atempt compactation
+    return res;
+  }
+
+  dotkernel<T,K,S,VI> rmv ()  // remove all dots 
+  {
+    dotkernel<T,K,S,VI> res;
+    for (const auto & dv : ds) 
+      res.c.insertdot(dv.first,false);
+    res.c.compact();
+    ds.clear(); // Clear the payload, but remember context
+    vi.clear();
+    return res;
+  }
+
+
+  // Wire encoding, the context (unless shared and encoded elsewhere) and 
+  // the dots of each id with their payloads
+  void encode(wireout & w, bool ctx=true) const
+  {
+    if (ctx) c.encode(w);
+    size_t ids=0;
+    for (auto it = ds.begin(); it != ds.end(); ++it)
+      if (it == ds.begin() || prev(it)->first.first != it->first.first) ids++;
+    w.uvarint(ids);
+    for (auto it = ds.begin(); it != ds.end();)
+    {
+      size_t dots=0;
+      auto end=it;
+      for (; end != ds.end() && end->first.first == it->first.first; ++end)
+        dots++;
+      w.id(it->first.first);
+      w.uvarint(dots);
+      int last=0;
+      for (; it != end; ++it)
+      {
+        ::encode(w,it->first.second-last);
+        ::encode(w,it->second);
+        last=it->first.second;
+      }
+    }
+  }
+
+  void decode(wirein & r, bool ctx=true)
+  {
+    if (ctx) c.decode(r);
+    ds.clear(); vi.clear();
+    pair<K,int> prev; bool first=true; // dots must come ordered, as in each
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      pair<pair<K,int>,T> dv;
+      r.id(dv.first.first);
+      int last=0;
+      for (size_t dots=r.count(); dots > 0 && r.next(last); dots--)
+      {
+        dv.first.second=last;
+        ::decode(r,dv.second);
+        if (! first && ! (prev < dv.first)) r.fail();
+        if (! r.good()) break;
+        ds.insert(ds.end(),dv);
+        vi.insert(dv.second,dv.first);
+        prev=dv.first; first=false;
+      }
+    }
+  }
+};
+
+// Counters read a running total only when it is exact. Sums of floating 
+// point values depend on the order of the additions, so they read the fold
+template<typename V> struct exacttotal : is_integral<V> {};
+
+template <typename V=int, typename K=string, template<typename> class A=allocator>
+class gcounter
+{
+private:
+  map<K,V,less<K>,A<pair<const K,V> > > m;
+  V total=0; // Fold of m, kept up to date by inc and join
+  K id;
+
+public:
+  gcounter() {} // Only for deltas and those should not be mutated
+  gcounter(K a) : id(a) {} // Mutable replicas need a unique id
+
+  gcounter inc(V tosum={1}) // argument is optional
+  {
+    gcounter<V,K,A> res;
+    V & e=m[id];
+    e+=tosum;
+    total+=tosum;
+    res.m[id]=e;
+    res.total=e;
+    return res;
+  }
+
+  bool operator == ( const gcounter<V,K,A>& o ) const 
+  { 
+    return m==o.m; 
+  }
+
+  V local() // get local counter value // CBM make this const
+  {
+    V res=0;
+    res += m[id];
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    return exacttotal<V>::value ? total : fold();
+  }
+
+  V fold() const // read, computed from the entries
+  {
+    V res=0;
+    for (const auto& kv : m) // Fold+ on value list
+      res += kv.second;
+    return res;
+  }
+
+  void join(const gcounter<V,K,A>& o)
+  {
+    for (const auto& okv : o.m)
+    {
+      V & e=m[okv.first];
+      if (e < okv.second) // the total grows by what the max adds
+      {
+        total+=okv.second-e;
+        e=okv.second;
+      }
+    }
+  }
+
+  friend ostream &operator<<( ostream &output, const gcounter<V,K,A>& o)
+  { 
+    output << "GCounter: ( ";
+    for (const auto& kv : o.m)
+      output << kv.first << "->" << kv.second << " ";
+    output << ")";
+    return output;            
+  }
+
+
+  void encode(wireout & w) const
+  {
+    w.uvarint(m.size());
+    for (const auto& kv : m) { w.id(kv.first); ::encode(w,kv.second); }
+  }
+
+  void decode(wirein & r)
+  {
+    m.clear();
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      pair<K,V> kv;
+      r.id(kv.first); ::decode(r,kv.second);
+      m.insert(m.end(),kv);
+    }
+    total=fold();
+  }
+};
+
+template <typename V=int, typename K=string, template<typename> class A=allocator>
+class pncounter
+{
+private:
+  gcounter<V,K,A> p,n;
+
+public:
   pncounter() {} // Only for deltas and those should not be mutated
   pncounter(K a) : p(a), n(a) {} // Mutable replicas need a unique id
 
-  pncounter inc(V tosum={1}) // Argument is optional
+  pncounter inc(V tosum={1}) // Argument is optional
+  {
+    pncounter<V,K,A> res;
+    res.p = p.inc(tosum); 
+    return res;
+  }
+
+  pncounter dec(V tosum={1}) // Argument is optional
+  {
+    pncounter<V,K,A> res;
+    res.n = n.inc(tosum); 
+    return res;
+  }
+
+  V local() // get local counter value
+  {
+    V res=p.local()-n.local();
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    V res=p.read()-n.read();
+    return res;
+  }
+
+  V fold() const { return p.fold()-n.fold(); }
+
+  void join(const pncounter& o)
+  {
+    p.join(o.p);
+    n.join(o.n);
+  }
+
+  friend ostream &operator<<( ostream &output, const pncounter<V,K,A>& o)
+  { 
+    output << "PNCounter:P:" << o.p << " PNCounter:N:" << o.n;
+    return output;            
+  }
+
+
+  void encode(wireout & w) const { p.encode(w); n.encode(w); }
+
+  void decode(wirein & r) { p.decode(r); n.decode(r); }
+};
+
+template <typename V=int, typename K=string, template<typename> class A=allocator>
+class lexcounter
+{
+private:
+  map<K,pair<int,V>,less<K>,A<pair<const K,pair<int,V> > > > m;
+  V total=0; // Fold of m, kept up to date by inc, dec and join
+  K id;
+
+public:
+  lexcounter() {} // Only for deltas and those should not be mutated
+  lexcounter(K a) : id(a) {} // Mutable replicas need a unique id
+
+  lexcounter inc(V tosum=1) // Argument is optional
+  {
+    lexcounter<V,K,A> res;
+
+//    m[id].first+=1; // optional
+    m[id].second+=tosum;
+    total+=tosum;
+    res.m[id]=m[id];
+    res.total=m[id].second;
+
+    return res;
+  }
+
+  lexcounter dec(V tosum=1) // Argument is optional
+  {
+    lexcounter<V,K,A> res;
+
+    m[id].first+=1; // mandatory
+    m[id].second-=tosum;
+    total-=tosum;
+    res.m[id]=m[id];
+    res.total=m[id].second;
+
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    return exacttotal<V>::value ? total : fold();
+  }
+
+  V fold() const // read, computed from the entries
+  {
+    V res=0;
+    for (const auto& kv : m) // Fold+ on value list
+      res +=  kv.second.second;
+    return res;
+  }
+
+  void join(const lexcounter<V,K,A>& o)
+  {
+    for (const auto& okv : o.m)
+    {
+      pair<int,V> & e=m[okv.first];
+      pair<int,V> j=lexjoin(okv.second,e);
+      total+=j.second-e.second;
+      e=j;
+    }
+  }
+
+  friend ostream &operator<<( ostream &output, const lexcounter<V,K,A>& o)
+  { 
+    output << "LexCounter: ( ";
+    for (const auto& kv : o.m)
+      output << kv.first << "->" << kv.second << " ";
+    output << ")";
+    return output;            
+  }
+
+
+  void encode(wireout & w) const
+  {
+    w.uvarint(m.size());
+    for (const auto& kv : m) { w.id(kv.first); ::encode(w,kv.second); }
+  }
+
+  void decode(wirein & r)
+  {
+    m.clear();
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      pair<K,pair<int,V> > kv;
+      r.id(kv.first); ::decode(r,kv.second);
+      m.insert(m.end(),kv);
+    }
+    total=fold();
+  }
+};
+
+template<typename K=string>
+class membership // Fixed replica set, ids mapped to dense indexes
+{
+private:
+  vector<K> ids;
+  map<K,size_t> index;
+
+public:
+  membership(initializer_list<K> l) : membership(vector<K>(l)) {}
+  membership(const vector<K> & v) : ids(v)
+  {
+    for (size_t i=0; i < ids.size(); i++) index[ids[i]]=i;
+    assert(index.size() == ids.size()); // ids must be unique
+  }
+
+  size_t size() const { return ids.size(); }
+  const K & id(size_t i) const { return ids[i]; }
+
+  size_t at(const K & k) const // throws out_of_range if k is not a member
+  {
+    auto it=index.find(k);
+    if (it == index.end()) throw out_of_range("membership::at");
+    return it->second;
+  }
+};
+
+template <typename V=int, typename K=string>
+class densegcounter // gcounter over a fixed membership, entries in a vector
+{
+private:
+  const membership<K> * ms=NULL; // must outlive the counter and its deltas
+  vector<V> m; // Deltas only hold entries up to the one they change
+  V total=0; // Fold of m, kept up to date by inc and join
+  size_t id=0;
+
+public:
+  densegcounter() {} // Only for deltas and those should not be mutated
+  densegcounter(const membership<K> & s, const K & a) :
+    ms(&s), m(s.size()), id(s.at(a)) {}
+
+  densegcounter inc(V tosum={1}) // argument is optional
+  {
+    densegcounter<V,K> res;
+    m[id]+=tosum;
+    total+=tosum;
+    res.ms=ms;
+    res.m.resize(id+1);
+    res.m[id]=m[id];
+    res.total=m[id];
+    return res;
+  }
+
+  bool operator == ( const densegcounter<V,K>& o ) const 
+  { 
+    size_t n=min(m.size(),o.m.size());
+    return equal(m.begin(),m.begin()+n,o.m.begin()) && 
+      all_of(m.begin()+n,m.end(),[](const V & v) { return v == 0; }) &&
+      all_of(o.m.begin()+n,o.m.end(),[](const V & v) { return v == 0; });
+  }
+
+  V local() const { return id < m.size() ? m[id] : 0; }
+
+  V read() const // get counter value
+  {
+    return exacttotal<V>::value ? total : fold();
+  }
+
+  V fold() const // read, computed from the entries
+  {
+    V res=0;
+    for (const auto& v : m) // Fold+ on value list
+      res += v;
+    return res;
+  }
+
+  void join(const densegcounter<V,K>& o)
+  {
+    if (ms == NULL) ms=o.ms;
+    if (m.size() < o.m.size()) m.resize(o.m.size());
+    // Element-wise max over contiguous arrays, a loop compilers vectorize
+    V * p=m.data();
+    const V * q=o.m.data();
+    V grown=0;
+    for (size_t i=0, n=o.m.size(); i < n; i++)
+    {
+      V v = p[i] < q[i] ? q[i] : p[i];
+      grown += v-p[i];
+      p[i]=v;
+    }
+    total+=grown;
+  }
+
+  friend ostream &operator<<( ostream &output, const densegcounter<V,K>& o)
+  { 
+    output << "DenseGCounter: ( ";
+    for (size_t i=0; i < o.m.size(); i++)
+      if (o.m[i] != 0)
+      {
+        if (o.ms != NULL && i < o.ms->size()) output << o.ms->id(i); 
+        else output << i;
+        output << "->" << o.m[i] << " ";
+      }
+    output << ")";
+    return output;            
+  }
+
+  void encode(wireout & w) const // ids are implied by the membership
+  {
+    w.uvarint(m.size());
+    for (const auto& v : m) ::encode(w,v);
+  }
+
+  // Into a counter with a membership, entries past its size are malformed,
+  // and deltas are padded to it. Deltas only hold entries up to their own
+  void decode(wirein & r)
+  {
+    m.clear();
+    size_t n=r.count();
+    if (ms != NULL && n > ms->size()) r.fail();
+    for (; n > 0 && r.good(); n--)
+    {
+      V v; ::decode(r,v);
+      m.push_back(v);
+    }
+    if (ms != NULL) m.resize(ms->size());
+    total=fold();
+  }
+};
+
+template <typename V=int, typename K=string>
+class densepncounter // pncounter over a fixed membership
+{
+private:
+  densegcounter<V,K> p,n;
+
+public:
+  densepncounter() {} // Only for deltas and those should not be mutated
+  densepncounter(const membership<K> & s, const K & a) : p(s,a), n(s,a) {}
+
+  densepncounter inc(V tosum={1}) // argument is optional
+  {
+    densepncounter<V,K> res;
+    res.p = p.inc(tosum);
+    return res;
+  }
+
+  densepncounter dec(V tosum={1}) // argument is optional
+  {
+    densepncounter<V,K> res;
+    res.n = n.inc(tosum);
+    return res;
+  }
+
+  bool operator == ( const densepncounter<V,K>& o ) const 
+  { 
+    return p == o.p && n == o.n; 
+  }
+
+  V local() const { return p.local()-n.local(); }
+
+  V read() const { return p.read()-n.read(); }
+
+  V fold() const { return p.fold()-n.fold(); }
+
+  void join(const densepncounter& o)
+  {
+    p.join(o.p);
+    n.join(o.n);
+  }
+
+  friend ostream &operator<<( ostream &output, const densepncounter<V,K>& o)
+  { 
+    output << "DensePNCounter:P:" << o.p << " DensePNCounter:N:" << o.n;
+    return output;            
+  }
+
+  void encode(wireout & w) const { p.encode(w); n.encode(w); }
+
+  void decode(wirein & r) { p.decode(r); n.decode(r); }
+};
+
+// a[i]=max(a[i],b[i]) and grown[i]+= what that added, the kernel of bank joins
+template<typename V>
+inline void maxjoin(V * a, const V * b, V * grown, size_t n)
+{
+  for (size_t i=0; i < n; i++)
+  {
+    V v = a[i] < b[i] ? b[i] : a[i];
+    grown[i] += v-a[i];
+    a[i]=v;
+  }
+}
+
+inline void maxjoin(int32_t * a, const int32_t * b, int32_t * grown, size_t n)
+{
+  size_t i=0;
+#if defined(__AVX2__)
+  for (; i+8 <= n; i+=8)
+  {
+    __m256i x=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a+i));
+    __m256i y=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b+i));
+    __m256i g=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(grown+i));
+    __m256i v=_mm256_max_epi32(x,y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(grown+i),
+      _mm256_add_epi32(g,_mm256_sub_epi32(v,x)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(a+i),v);
+  }
+#elif defined(__SSE4_1__)
+  for (; i+4 <= n; i+=4)
+  {
+    __m128i x=_mm_loadu_si128(reinterpret_cast<const __m128i *>(a+i));
+    __m128i y=_mm_loadu_si128(reinterpret_cast<const __m128i *>(b+i));
+    __m128i g=_mm_loadu_si128(reinterpret_cast<const __m128i *>(grown+i));
+    __m128i v=_mm_max_epi32(x,y);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(grown+i),
+      _mm_add_epi32(g,_mm_sub_epi32(v,x)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(a+i),v);
+  }
+#endif
+  maxjoin<int32_t>(a+i,b+i,grown+i,n-i); // the tail, or all without SIMD
+}
+
+template <typename V=int, typename K=string>
+class gcounterbank // Many gcounters over a fixed membership, by columns
+{
+private:
+  const membership<K> * ms=NULL; // must outlive the bank
+  size_t n=0; // number of counters
+  vector<V> m; // replica r entry of counter i at m[r*n+i]
+  vector<V> total; // Fold of each counter, kept up to date by inc and join
+  size_t id=0;
+
+public:
+  gcounterbank() {} // Only to decode or join into, see join
+  gcounterbank(const membership<K> & s, const K & a, size_t counters) :
+    ms(&s), n(counters), m(s.size()*counters), total(counters), id(s.at(a)) {}
+
+  size_t size() const { return n; }
+
+  void inc(size_t i, V tosum={1}) // argument is optional
   {
-    pncounter<V,K> res;
-    res.p = p.inc(tosum); 
-    return res;
+    m[id*n+i]+=tosum;
+    total[i]+=tosum;
   }
 
-  pncounter dec(V tosum={1}) // Argument is optional
-  {
-    pncounter<V,K> res;
-    res.n = n.inc(tosum); 
-    return res;
+  bool operator == ( const gcounterbank<V,K>& o ) const 
+  { 
+    return m == o.m; 
   }
 
-  V local() // get local counter value
+  V local(size_t i) const { return m[id*n+i]; }
+
+  V read(size_t i) const // get counter i value
   {
-    V res=p.local()-n.local();
-    return res;
+    return exacttotal<V>::value ? total[i] : fold(i);
   }
 
-  V read() const // get counter value
+  V fold(size_t i) const // read, computed from the entries
   {
-    V res=p.read()-n.read();
+    V res=0;
+    for (size_t r=0; r < ms->size(); r++) // Fold+ on the replica entries
+      res += m[r*n+i];
     return res;
   }
 
-  void join(const pncounter& o)
+  void join(const gcounterbank<V,K>& o) // merge a whole shard
   {
-    p.join(o.p);
-    n.join(o.n);
+    if (o.ms == NULL) return; // nothing to merge
+    if (ms == NULL) // a default bank takes the shape of the other
+    {
+      ms=o.ms; n=o.n; m=o.m; total=o.total;
+      return;
+    }
+    assert(n == o.n && m.size() == o.m.size()); // same counters and replicas
+    for (size_t r=0; r < ms->size(); r++)
+      maxjoin(m.data()+r*n,o.m.data()+r*n,total.data(),n);
   }
 
-  friend ostream &operator<<( ostream &output, const pncounter<V,K>& o)
+  friend ostream &operator<<( ostream &output, const gcounterbank<V,K>& o)
   { 
-    output << "PNCounter:P:" << o.p << " PNCounter:N:" << o.n;
+    output << "GCounterBank: ( ";
+    for (size_t i=0; i < o.n; i++)
+      output << i << "->" << o.read(i) << " ";
+    output << ")";
     return output;            
   }
 
+  void encode(wireout & w) const // ids are implied by the membership
+  {
+    w.uvarint(m.size());
+    for (const auto& v : m) ::encode(w,v);
+  }
+
+  void decode(wirein & r)
+  {
+    if (r.count() != m.size()) { r.fail(); return; } // other shape
+    for (auto& v : m) ::decode(r,v);
+    for (size_t i=0; i < n; i++) total[i]=fold(i);
+  }
 };
 
 template <typename V=int, typename K=string>
-class lexcounter
+class pncounterbank // Many pncounters over a fixed membership
 {
 private:
-  map<K,pair<int,V> > m;
-  K id;
+  gcounterbank<V,K> p,n;
 
 public:
-  lexcounter() {} // Only for deltas and those should not be mutated
-  lexcounter(K a) : id(a) {} // Mutable replicas need a unique id
+  pncounterbank() {}
+  pncounterbank(const membership<K> & s, const K & a, size_t counters) :
+    p(s,a,counters), n(s,a,counters) {}
 
-  lexcounter inc(V tosum=1) // Argument is optional
-  {
-    lexcounter<V,K> res;
+  size_t size() const { return p.size(); }
 
-//    m[id].first+=1; // optional
-    m[id].second+=tosum;
-    res.m[id]=m[id];
+  void inc(size_t i, V tosum={1}) { p.inc(i,tosum); }
 
-    return res;
-  }
+  void dec(size_t i, V tosum={1}) { n.inc(i,tosum); }
 
-  lexcounter dec(V tosum=1) // Argument is optional
-  {
-    lexcounter<V,K> res;
+  bool operator == ( const pncounterbank<V,K>& o ) const 
+  { 
+    return p == o.p && n == o.n; 
+  }
 
-    m[id].first+=1; // mandatory
-    m[id].second-=tosum;
-    res.m[id]=m[id];
+  V local(size_t i) const { return p.local(i)-n.local(i); }
 
-    return res;
-  }
+  V read(size_t i) const { return p.read(i)-n.read(i); }
 
-  V read() const // get counter value
-  {
-    V res=0;
-    for (const auto& kv : m) // Fold+ on value list
-      res +=  kv.second.second;
-    return res;
-  }
+  V fold(size_t i) const { return p.fold(i)-n.fold(i); }
 
-  void join(const lexcounter<V,K>& o)
+  void join(const pncounterbank& o)
   {
-    for (const auto& okv : o.m)
-      m[okv.first]=lexjoin(okv.second,m[okv.first]); 
+    p.join(o.p);
+    n.join(o.n);
   }
 
-  friend ostream &operator<<( ostream &output, const lexcounter<V,K>& o)
+  friend ostream &operator<<( ostream &output, const pncounterbank<V,K>& o)
   { 
-    output << "LexCounter: ( ";
-    for (const auto& kv : o.m)
-      output << kv.first << "->" << kv.second << " ";
+    output << "PNCounterBank: ( ";
+    for (size_t i=0; i < o.size(); i++)
+      output << i << "->" << o.read(i) << " ";
     output << ")";
     return output;            
   }
 
+  void encode(wireout & w) const { p.encode(w); n.encode(w); }
+
+  void decode(wirein & r) { p.decode(r); n.decode(r); }
 };
 
-template<typename V, typename K=string>
+template<typename V, typename K=string, typename S=mapstore>
 class ccounter    // Causal counter, variation of Riak_dt_emcntr and lexcounter 
 {
 private:
   // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<V,K> dk; // Dot kernel
+  dotkernel<V,K,S> dk; // Dot kernel
   K id;
+  pair<K,int> own; // Last dot of this replica, checked before use
+
+  ccounter<V,K,S> update (const V& val)
+  {
+    // The single dot of this replica, if the tracked one is gone look it up 
+    // among the dots of id, e.g. after decoding or a reset
+    auto dsit=dk.ds.find(own);
+    if (dsit == dk.ds.end())
+    {
+      dsit=dk.ds.lower_bound(pair<K,int>(id,0));
+      if (dsit != dk.ds.end() && dsit->first.first != id) dsit=dk.ds.end();
+    }
+    V base = {}; // typically 0
+    if (dsit != dk.ds.end()) 
+    {
+      base=dsit->second;
+      own=dsit->first;
+    }
+    ccounter<V,K,S> r;
+    r.dk=dk.replace(own,id,base+val);
+    own=r.dk.ds.begin()->first;
+    return r;
+  }
 
 public:
   ccounter() {} // Only for deltas and those should not be mutated
   ccounter(K k) : id(k) {} // Mutable replicas need a unique id
-  ccounter(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  ccounter(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
 
-  dotcontext<K> & context()
+  typedef dotkernelview<V,K> view; // Encoded deltas, see joinbytes
+
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
-  friend ostream &operator<<( ostream &output, const ccounter<V,K>& o)
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const ccounter<V,K,S>& o)
   { 
     output << "CausalCounter:" << o.dk;
     return output;            
   }
 
-  ccounter<V,K> inc (const V& val=1) 
+  ccounter<V,K,S> inc (const V& val=1) 
   {
-    ccounter<V,K> r;
-    set<pair<K,int>> dots; // dots to remove, should be only 1
-    V base = {}; // typically 0
-    for(const auto & dsit : dk.ds)
-    {
-      if (dsit.first.first == id) // there should be a single one such
-      {
-        base=max(base,dsit.second);
-        dots.insert(dsit.first);
-      }
-    }
-    for(const auto & dot : dots)
-      r.dk.join(dk.rmv(dot));
-    r.dk.join(dk.add(id,base+val));
-    return r;
+    return update(val);
   }
 
-  ccounter<V,K> dec (const V& val=1) 
+  ccounter<V,K,S> dec (const V& val=1) 
   {
-    ccounter<V,K> r;
-    set<pair<K,int>> dots; // dots to remove, should be only 1
-    V base = {}; // typically 0
-    for(const auto & dsit : dk.ds)
-    {
-      if (dsit.first.first == id) // there should be a single one such
-      {
-        base=max(base,dsit.second);
-        dots.insert(dsit.first);
-      }
-    }
-    for(const auto & dot : dots)
-      r.dk.join(dk.rmv(dot));
-    r.dk.join(dk.add(id,base-val));
-    return r;
+    return update(-val);
   }
 
-  ccounter<V,K> reset () // Other nodes might however upgrade their counts
+  ccounter<V,K,S> reset () // Other nodes might however upgrade their counts
   {
-    ccounter<V,K> r;
+    ccounter<V,K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
@@ -720,19 +3313,34 @@ public:
     return v;
   }
 
-  void join (ccounter<V,K> o)
+  void join (const ccounter<V,K,S> & o)
   {
     dk.join(o.dk);
   }
 
+  void join (ccounter<V,K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
 
-template<typename T>
+template<typename T, template<typename> class A=allocator, typename E=setstore>
 class gset
 {
 private:
-  set<T> s;
+  typedef typename E::template elems<T,A> elemset;
+  elemset s;
 
 public:
 
@@ -745,43 +3353,51 @@ public:
 //    return dotcontext<K>();
 //  }
 
-  set<T> read () const { return s; }
+  elemset read () const { return s; }
 
-  bool operator == ( const gset<T>& o ) const { return s==o.s; }
+  bool operator == ( const gset<T,A,E>& o ) const { return s==o.s; }
 
   bool in (const T& val) 
   { 
     return s.count(val);
   }
 
-  friend ostream &operator<<( ostream &output, const gset<T>& o)
+  friend ostream &operator<<( ostream &output, const gset<T,A,E>& o)
   { 
     output << "GSet: " << o.s;
     return output;            
   }
 
-  gset<T> add (const T& val) 
+  gset<T,A,E> add (const T& val) 
   { 
-    gset<T> res;
+    gset<T,A,E> res;
     s.insert(val); 
     res.s.insert(val); 
     return res; 
   }
 
-  void join (const gset<T>& o)
+  void join (const gset<T,A,E>& o)
   {
     s.insert(o.s.begin(), o.s.end());
   }
 
+
+  void encode(wireout & w) const { ::encode(w,s); }
+
+  void decode(wirein & r) { ::decode(r,s); }
 };
 
 
-template<typename T, typename K=string> // Map embedable datatype
+template<typename T, typename K=string, 
+  template<typename> class A=allocator, 
+  typename E=setstore> // Map embedable datatype
 class twopset
 {
 private:
-  set<T> s;
-  set<T> t;  // removed elements are added to t and removed from s
+  typedef typename E::template elems<T,A> elemset;
+  typedef typename E::template tombs<T,A> tombset;
+  elemset s;
+  tombset t;  // removed elements are added to t and removed from s
 
 public:
 
@@ -793,9 +3409,9 @@ public:
     return dotcontext<K>();
   }
 
-  set<T> read () { return s; }
+  elemset read () { return s; }
 
-  bool operator == ( const twopset<T>& o ) const 
+  bool operator == ( const twopset<T,K,A,E>& o ) const 
   { 
     return s==o.s && t==o.t; 
   }
@@ -805,15 +3421,15 @@ public:
     return s.count(val);
   }
 
-  friend ostream &operator<<( ostream &output, const twopset<T>& o)
+  friend ostream &operator<<( ostream &output, const twopset<T,K,A,E>& o)
   { 
     output << "2PSet: S" << o.s << " T " << o.t;
     return output;            
   }
 
-  twopset<T> add (const T& val) 
+  twopset<T,K,A,E> add (const T& val) 
   { 
-    twopset<T> res;
+    twopset<T,K,A,E> res;
     if (t.count(val) == 0) // only add if not in tombstone set
     {
       s.insert(val);
@@ -822,18 +3438,18 @@ public:
     return res; 
   }
 
-  twopset<T> rmv (const T& val) 
+  twopset<T,K,A,E> rmv (const T& val) 
   { 
-    twopset<T> res;
+    twopset<T,K,A,E> res;
     s.erase(val);
     t.insert(val); // add to tombstones
     res.t.insert(val); 
     return res; 
   }
 
-  twopset<T> reset ()
+  twopset<T,K,A,E> reset ()
   {
-    twopset<T> res;
+    twopset<T,K,A,E> res;
     for (auto const & val : s)
     {
       t.insert(val);
@@ -843,8 +3459,10 @@ public:
     return res; 
   }
 
-  void join (const twopset<T>& o)
+  void join (const twopset<T,K,A,E>& o)
   {
+    presize(t,t.size()+o.t.size(),0); // hash sets are sized once
+    presize(s,s.size()+o.s.size(),0);
     for (const auto& ot : o.t) // see other tombstones
     {
       t.insert(ot); // insert them locally
@@ -856,222 +3474,268 @@ public:
       if (t.count(os) == 0) s.insert(os);
     }
   }
+
+  // The empty context of map compliance is not encoded
+  void encode(wireout & w, bool=true) const 
+  { 
+    ::encode(w,s); ::encode(w,t); 
+  }
+
+  void decode(wirein & r, bool=true) { ::decode(r,s); ::decode(r,t); }
 };
 
 
-template<typename E, typename K=string> // Map embedable datatype
+template<typename E, typename K=string, typename S=mapstore> // Map embedable datatype
 class aworset    // Add-Wins Observed-Remove Set
 {
 private:
-  dotkernel<E,K> dk; // Dot kernel
+  dotkernel<E,K,S,true> dk; // Dot kernel, indexed by value
   K id;
 
 public:
   aworset() {} // Only for deltas and those should not be mutated
   aworset(K k) : id(k) {} // Mutable replicas need a unique id
-  aworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  aworset(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
+
+  typedef dotkernelview<E,K> view; // Encoded deltas, see joinbytes
 
-  dotcontext<K> & context()
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
-  friend ostream &operator<<( ostream &output, const aworset<E,K>& o)
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const aworset<E,K,S>& o)
   { 
     output << "AWORSet:" << o.dk;
     return output;            
   }
 
 
-  set<E> read ()
+  // The value index holds each element once, in order, and is kept by 
+  // add, rmv, reset and join, including removes that come in the context
+  auto elements () const -> decltype(dk.vi.values()) // not copied
   {
-    set<E> res;
-    for (const auto &dv : dk.ds)
-      res.insert(dv.second);
-    return res;
+    return dk.vi.values();
+  }
+
+  set<E> read () const
+  {
+    auto es=elements();
+    return set<E>(es.begin(),es.end()); // from sorted input, in linear time
   }
 
-  bool in (const E& val) 
+  bool in (const E& val) const
   { 
-    typename map<pair<K,int>,E>::iterator dsit;
-    for(dsit=dk.ds.begin(); dsit != dk.ds.end();++dsit)
-    {
-      if (dsit->second == val)
-        return true;
-    }
-    return false;
+    return dk.in(val);
   }
 
 
-  aworset<E,K> add (const E& val) 
+  aworset<E,K,S> add (const E& val) 
   {
-    aworset<E,K> r;
+    aworset<E,K,S> r;
     r.dk=dk.rmv(val); // optimization that first deletes val
     r.dk.join(dk.add(id,val));
     return r;
   }
 
-  aworset<E,K> rmv (const E& val)
+  aworset<E,K,S> rmv (const E& val)
   {
-    aworset<E,K> r;
+    aworset<E,K,S> r;
     r.dk=dk.rmv(val); 
     return r;
   }
   
-  aworset<E,K> reset()
+  aworset<E,K,S> reset()
   {
-    aworset<E,K> r;
+    aworset<E,K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
 
-  void join (aworset<E,K> o)
+  void join (const aworset<E,K,S> & o)
   {
     dk.join(o.dk);
     // Further optimization can be done by keeping for val x and id A 
     // only the highest dot from A supporting x. 
   }
+
+  void join (const aworset<E,K,S> & o, unsigned threads) // for large sets
+  {
+    dk.join(o.dk,threads);
+  }
+
+  void join (aworset<E,K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
-template<typename E, typename K=string> // Map embedable datatype
+template<typename E, typename K=string, typename S=mapstore> // Map embedable datatype
 class rworset    // Remove-Wins Observed-Remove Set
 {
 private:
-  dotkernel<pair<E,bool>,K> dk; // Dot kernel
+  dotkernel<pair<E,bool>,K,S,true> dk; // Dot kernel, indexed by value
   K id;
 
 public:
   rworset() {} // Only for deltas and those should not be mutated
   rworset(K k) : id(k) {} // Mutable replicas need a unique id
-  rworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  rworset(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
+
+  typedef dotkernelview<pair<E,bool>,K> view; // Encoded deltas, see joinbytes
 
-  dotcontext<K> & context()
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
 
-  friend ostream &operator<<( ostream &output, const rworset<E,K>& o)
+
+  friend ostream &operator<<( ostream &output, const rworset<E,K,S>& o)
   { 
     output << "RWORSet:" << o.dk;
     return output;            
   }
 
-  set<E> read ()
+  // The value index keeps the tokens of each element, a remove token of 
+  // an element (e,false) just before its add token (e,true)
+  set<E> read () const
   {
     set<E> res;
-    map<E,bool> elems;
-    typename map<pair<K,int>,pair<E,bool> >::iterator dsit;
-    pair<typename map<E,bool>::iterator,bool> ret;
-    for(dsit=dk.ds.begin(); dsit != dk.ds.end();++dsit)
-    {
-      ret=elems.insert(pair<E,bool>(dsit->second));
-      if (ret.second==false) // val already exists
-      {
-        elems.at(ret.first->first) &= dsit->second.second; // Fold by &&
-      }
-    }
-    typename map<E,bool>::iterator mit;
-    for (mit=elems.begin(); mit != elems.end(); ++mit)
+    const E * removed=NULL;
+    for (const auto & vd : dk.vi)
     {
-      if (mit->second == true) res.insert(mit->first);
+      if (! vd.first.second) 
+        removed=&vd.first.first;
+      else if (removed == NULL || *removed < vd.first.first) 
+        res.insert(res.end(),vd.first.first);
     }
     return res;
   }
 
-  bool in (const E& val) // Could
+  bool in (const E& val) const
   { 
-    // Code could be slightly faster if re-using only part of read code
-    set<E> s=read();
-    if ( s.find(val) != s.end() ) return true;
-    return false;
+    return dk.in(pair<E,bool>(val,true)) && ! dk.in(pair<E,bool>(val,false));
   }
 
 
-  rworset<E,K> add (const E& val) 
+  rworset<E,K,S> add (const E& val) 
   {
-    rworset<E,K> r;
+    rworset<E,K,S> r;
     r.dk=dk.rmv(pair<E,bool>(val,true));  // Remove any observed add token
     r.dk.join(dk.rmv(pair<E,bool>(val,false))); // Remove any observed remove token
     r.dk.join(dk.add(id,pair<E,bool>(val,true)));
     return r;
   }
 
-  rworset<E,K> rmv (const E& val)
+  rworset<E,K,S> rmv (const E& val)
   {
-    rworset<E,K> r;
+    rworset<E,K,S> r;
     r.dk=dk.rmv(pair<E,bool>(val,true));  // Remove any observed add token
     r.dk.join(dk.rmv(pair<E,bool>(val,false))); // Remove any observed remove token
     r.dk.join(dk.add(id,pair<E,bool>(val,false)));
     return r;
   }
 
-  rworset<E,K> reset()
+  rworset<E,K,S> reset()
   {
-    rworset<E,K> r;
+    rworset<E,K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
 
 
-  void join (rworset<E,K> o)
+  void join (const rworset<E,K,S> & o)
   {
     dk.join(o.dk);
   }
+
+  void join (rworset<E,K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
 
 
-template<typename V, typename K=string>
+template<typename V, typename K=string, typename S=mapstore>
 class mvreg    // Multi-value register, Optimized
 {
 private:
-  dotkernel<V,K> dk; // Dot kernel
+  dotkernel<V,K,S,true> dk; // Dot kernel, indexed by value
   K id;
 
 public:
   mvreg() {} // Only for deltas and those should not be mutated
   mvreg(K k) : id(k) {} // Mutable replicas need a unique id
-  mvreg(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  mvreg(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
 
-  dotcontext<K> & context()
+  typedef dotkernelview<V,K> view; // Encoded deltas, see joinbytes
+
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
-  friend ostream &operator<<( ostream &output, const mvreg<V,K>& o)
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const mvreg<V,K,S>& o)
   { 
     output << "MVReg:" << o.dk;
     return output;            
   }
 
-  mvreg<V,K> write (const V& val) 
+  mvreg<V,K,S> write (const V& val) 
   {
-    mvreg<V,K> r,a;
+    mvreg<V,K,S> r,a;
     r.dk=dk.rmv(); 
     a.dk=dk.add(id,val);
     r.join(a);
     return r;
   }
 
-  set<V> read ()
+  auto values () const -> decltype(dk.vi.values()) // not copied, see aworset
   {
-    set<V> s;
-    for (const auto & dse : dk.ds)
-      s.insert(dse.second);
-    return s;
+    return dk.vi.values();
+  }
+
+  set<V> read () const
+  {
+    auto vs=values();
+    return set<V>(vs.begin(),vs.end());
   }
 
-  mvreg<V,K> reset()
+  mvreg<V,K,S> reset()
   {
-    mvreg<V,K> r;
+    mvreg<V,K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
 
-  mvreg<V,K> resolve()
+  mvreg<V,K,S> resolve()
   {
-    mvreg<V,K> r,v;
+    mvreg<V,K,S> r,v;
     set<V> s; // collect all values that are not maximals
     for (const auto & dsa : dk.ds) // Naif quadratic comparison
       for (const auto & dsb : dk.ds)
@@ -1088,32 +3752,50 @@ public:
     return r;
   }
 
-  void join (mvreg<V,K> o)
+  void join (const mvreg<V,K,S> & o)
   {
     dk.join(o.dk);
   }
+
+  void join (mvreg<V,K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
 
-template<typename K=string>
+template<typename K=string, typename S=mapstore>
 class ewflag    // Enable-Wins Flag
 {
 private:
   // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<bool,K> dk; // Dot kernel
+  dotkernel<bool,K,S> dk; // Dot kernel
   K id;
 
 public:
   ewflag() {} // Only for deltas and those should not be mutated
   ewflag(K k) : id(k) {} // Mutable replicas need a unique id
-  ewflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  ewflag(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
+
+  typedef dotkernelview<bool,K> view; // Encoded deltas, see joinbytes
 
-  dotcontext<K> & context()
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
-  friend ostream &operator<<( ostream &output, const ewflag<K>& o)
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const ewflag<K,S>& o)
   { 
     output << "EWFlag:" << o.dk;
     return output;            
@@ -1121,7 +3803,6 @@ public:
 
   bool read ()
   {
-    typename map<pair<K,int>,bool>::iterator dsit;
     if ( dk.ds.begin() == dk.ds.end()) 
       // No active dots
       return false;
@@ -1130,53 +3811,71 @@ public:
       return true;
   }
 
-  ewflag<K> enable () 
+  ewflag<K,S> enable () 
   {
-    ewflag<K> r;
-    r.dk=dk.rmv(true); // optimization that first deletes active dots
+    ewflag<K,S> r;
+    r.dk=dk.rmv(); // optimization that first deletes active (true) dots
     r.dk.join(dk.add(id,true));
     return r;
   }
 
-  ewflag<K> disable ()
+  ewflag<K,S> disable ()
   {
-    ewflag<K> r;
-    r.dk=dk.rmv(true); 
+    ewflag<K,S> r;
+    r.dk=dk.rmv(); // all active dots are true
     return r;
   }
 
-  ewflag<K> reset()
+  ewflag<K,S> reset()
   {
-    ewflag<K> r;
+    ewflag<K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
 
-  void join (ewflag<K> o)
+  void join (const ewflag<K,S> & o)
   {
     dk.join(o.dk);
   }
+
+  void join (ewflag<K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
-template<typename K=string>
+template<typename K=string, typename S=mapstore>
 class dwflag    // Disable-Wins Flag
 {
 private:
   // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<bool,K> dk; // Dot kernel
+  dotkernel<bool,K,S> dk; // Dot kernel
   K id;
 
 public:
   dwflag() {} // Only for deltas and those should not be mutated
   dwflag(K k) : id(k) {} // Mutable replicas need a unique id
-  dwflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  dwflag(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
 
-  dotcontext<K> & context()
+  typedef dotkernelview<bool,K> view; // Encoded deltas, see joinbytes
+
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
-  friend ostream &operator<<( ostream &output, const dwflag<K>& o)
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const dwflag<K,S>& o)
   { 
     output << "DWFlag:" << o.dk;
     return output;            
@@ -1184,7 +3883,6 @@ public:
 
   bool read ()
   {
-    typename map<pair<K,int>,bool>::iterator dsit;
     if ( dk.ds.begin() == dk.ds.end()) 
       // No active dots
       return true;
@@ -1193,47 +3891,62 @@ public:
       return false;
   }
 
-  dwflag<K> disable () 
+  dwflag<K,S> disable () 
   {
-    dwflag<K> r;
-    r.dk=dk.rmv(false); // optimization that first deletes active dots
+    dwflag<K,S> r;
+    r.dk=dk.rmv(); // optimization that first deletes active (false) dots
     r.dk.join(dk.add(id,false));
     return r;
   }
 
-  dwflag<K> enable ()
+  dwflag<K,S> enable ()
   {
-    dwflag<K> r;
-    r.dk=dk.rmv(false); 
+    dwflag<K,S> r;
+    r.dk=dk.rmv(); // all active dots are false
     return r;
   }
 
-  dwflag<K> reset()
+  dwflag<K,S> reset()
   {
-    dwflag<K> r;
+    dwflag<K,S> r;
     r.dk=dk.rmv(); 
     return r;
   }
 
-  void join (dwflag<K> o)
+  void join (const dwflag<K,S> & o)
   {
     dk.join(o.dk);
   }
+
+  void join (dwflag<K,S> && o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  void join (const view & o)
+  {
+    dk.join(o);
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); }
 };
 
 // U is timestamp, T is payload
-template<typename U, typename T>
+template<typename U, typename T, template<typename> class A=allocator>
 class rwlwwset // remove wins bias for identical timestamps
 {
 private:
-  map<T,pair<U,bool> > s;
+  typedef map<T,pair<U,bool>,less<T>,A<pair<const T,pair<U,bool> > > > lwwmap;
+  lwwmap s;
 
-  rwlwwset<U,T> addrmv(const U& ts, const T& val, bool b)
+  rwlwwset<U,T,A> addrmv(const U& ts, const T& val, bool b)
   {
-    rwlwwset<U,T> res;
+    rwlwwset<U,T,A> res;
     pair<U,bool> a(ts,b);
     res.s.insert(pair<T,pair<U,bool> >(val,a));
-    pair<typename map<T,pair<U,bool> >::iterator,bool> ret;
+    pair<typename lwwmap::iterator,bool> ret;
     ret=s.insert(pair<T,pair<U,bool> >(val,a));
     if (ret.second == false ) // some value there
     {
@@ -1244,10 +3957,10 @@ private:
 
 public:
 
-  friend ostream &operator<<( ostream &output, const rwlwwset<U,T>& o)
+  friend ostream &operator<<( ostream &output, const rwlwwset<U,T,A>& o)
   { 
     output << "RW LWWSet: ( ";
-    for(typename  map< T,pair<U,bool> >::const_iterator it=o.s.begin(); it != o.s.end(); ++it)
+    for(typename lwwmap::const_iterator it=o.s.begin(); it != o.s.end(); ++it)
     {
       if( it->second.second == false)
         output << it->first << " ";
@@ -1256,12 +3969,12 @@ public:
     return output;            
   }
 
-  rwlwwset<U,T> add(const U& ts, const T& val)
+  rwlwwset<U,T,A> add(const U& ts, const T& val)
   {
     return addrmv(ts,val,false);
   }
 
-  rwlwwset<U,T> rmv(const U& ts, const T& val)
+  rwlwwset<U,T,A> rmv(const U& ts, const T& val)
   {
     return addrmv(ts,val,true);
   }
@@ -1269,19 +3982,19 @@ public:
 
   bool in (const T& val) 
   { 
-    typename  map<T,pair<U,bool> >::const_iterator it=s.find(val); 
+    typename lwwmap::const_iterator it=s.find(val); 
     if ( it == s.end() || it->second.second == true)
       return false;
     else
       return true;
   }
 
-  void join (const rwlwwset<U,T> & o)
+  void join (const rwlwwset<U,T,A> & o)
   {
     if (this == &o) return; // Join is idempotent, but just dont do it.
     // will iterate over the two sorted sets to compute join
-    typename  map< T, pair<U,bool> >::iterator it; 
-    typename  map< T, pair<U,bool> >::const_iterator ito; 
+    typename lwwmap::iterator it; 
+    typename lwwmap::const_iterator ito; 
     it=s.begin(); ito=o.s.begin();
     do 
     {
@@ -1309,6 +4022,10 @@ public:
   }
 
 
+
+  void encode(wireout & w) const { ::encode(w,s); }
+
+  void decode(wirein & r) { ::decode(r,s); }
 };
 
 template<typename U, typename T>
@@ -1346,35 +4063,80 @@ public:
   {
     return r.second;
   }
+
+  void encode(wireout & w) const { ::encode(w,r); }
+
+  void decode(wirein & i) { ::decode(i,r); }
 };
 
 template<typename N, typename V, typename K=string>
 class ormap
 {
-  map<N,V> m;  
+  // Values share the map context, so its type, and allocator, are theirs
+  typedef typename remove_reference<
+    decltype(declval<V&>().context())>::type dotctx;
+
+  map<N,V,less<N>,typename dotctx::template alloc<pair<const N,V> > > m;  
   
-  dotcontext<K> cbase;
-  dotcontext<K> & c;
+  dotctx cbase;
+  dotctx & c;
   K id;
 
+  // Index from the dots of the values to their keys, so that a join only
+  // visits the keys of the other map and those with dots it covers. It is
+  // built by a join, for values that list their dots (eachdot), and kept 
+  // while the context counts no other changes than the joins and applies
+  // of the map, that index the dots they add. Values can be changed 
+  // through references kept from operator[], so when the context did 
+  // change otherwise, it is built again. Dots that were removed locally 
+  // may linger, they only cost a visit
+  map<pair<K,int>,N,less<pair<K,int> >,
+    typename dotctx::template alloc<pair<const pair<K,int>,N> > > dots;
+  bool indexed=false;
+  size_t mark=0; // changes of the context when the index was last valid
+
+  struct dotsink // Adds the dots of a value under its key
+  {
+    ormap<N,V,K> * o; const N * k;
+    void operator()(const pair<K,int> & d) const { o->dots[d]=*k; }
+  };
+
   public:
   // if no causal context supplied, use base one
   ormap() : c(cbase) {} 
   ormap(K i) : id(i), c(cbase) {} 
   // if supplied, use a shared causal context
-  ormap(K i, dotcontext<K> &jointc) : id(i), c(jointc) {} 
+  ormap(K i, dotctx &jointc) : id(i), c(jointc) {} 
 
-//  ormap( const ormap<N,V,K>& o ) :  id(o.id), m(o.m), c(o.c) {}
+  // copies keep using a shared context, but get their own base one 
+  ormap(const ormap<N,V,K> & o) : c(&o.c == &o.cbase ? cbase : o.c) 
+  { 
+    *this=o; 
+  }
 
   ormap<N,V,K> & operator=(const ormap<N,V,K> & o)
   {
     if (&o == this) return *this;
-    if (&c != &o.c) c=o.c; 
-    m=o.m; id=o.id;
+    id=o.id;
+    if (&c == &o.c) // values of the same context are copied as they are
+    {
+      m=o.m; 
+      dots=o.dots; indexed=o.indexed; mark=o.mark;
+      return *this;
+    }
+    // Others are joined into new values, that use this context
+    m.clear(); 
+    dots.clear(); indexed=false;
+    c=dotctx();
+    {
+      holdscope<dotctx> h(c);
+      for (const auto & kv : o.m) (*this)[kv.first].join(kv.second);
+    }
+    c=o.c;
     return *this;
   }
 
-  dotcontext<K> & context() const
+  dotctx & context() const
   {
     return c;
   }
@@ -1383,16 +4145,28 @@ class ormap
   { 
     output << "Map:" << o.c << endl;
     for (const auto & kv : o.m)
-      cout << kv.first << "->" << kv.second << endl;
+      output << kv.first << "->" << kv.second << endl;
     return output;            
   }
 
-  // Need to find a way to collect deltas for this interface
+  template<typename F> void eachkey (F f) const // each key, in order
+  {
+    for (const auto & kv : m) f(kv.first);
+  }
+
+  template<typename F, typename W=V> // The dots of all values, see dotkernel
+  auto eachdot (F f) const -> decltype(declval<const W&>().eachdot(f), void())
+  {
+    for (const auto & kv : m) kv.second.eachdot(f);
+  }
+
+  // Mutations through the reference are not collected in a delta, see apply
   V& operator[] (const N& n)
   {
     auto i = m.find(n);
     if (i == m.end()) // 1st key access
     {
+      allocscope<decltype(m.get_allocator())> as(m.get_allocator());
       auto ins = m.insert(i,pair<N,V>(n,V(id,c)));
       return ins->second;
 
@@ -1401,238 +4175,489 @@ class ormap
     {
       return i->second;
     }
-  }
-
-  ormap<N,V,K> erase(const N & n)
-  {
-    ormap<N,V,K> r;
-    if (m.count(n) != 0)
+  }
+
+  // Applies a mutator to the value of a key, f(V&) returning its delta, 
+  // and returns that delta under the key, as a map delta
+  template<typename F>
+  ormap<N,V,K> apply(const N & n, F f)
+  {
+    ormap<N,V,K> r;
+    bool current = indexed && c.changes == mark;
+    (*this)[n]; // the key, added if missing
+    auto it=m.find(n);
+    r[n].join(f(it->second));
+    if (current) // the new dots are those of the delta
+    {
+      indexdots(r.m.begin()->second,&it->first,0);
+      mark=c.changes;
+    }
+    return r;
+  }
+
+  ormap<N,V,K> erase(const N & n)
+  {
+    ormap<N,V,K> r;
+    if (m.count(n) != 0)
+    {
+      // need to collect erased dots, and list then in r context
+      V v;
+      v=m[n].reset();
+      r.c=v.context();
+      // now erase
+      m.erase(n);
+    }
+    return r;
+  }
+
+  ormap<N,V,K> reset()
+  {
+    ormap<N,V,K> r;
+    if (! m.empty())
+    {
+      // need to collect erased dots, and list then in r context
+      for (auto & kv : m)
+      {
+        V v;
+        v=kv.second.reset();
+        r.c.join(v.context());
+      }
+      m.clear();
+      dots.clear();
+    }
+    return r;
+  }
+
+
+  void join (const ormap<N,V,K> & o, unsigned threads=1)
+  {
+    // The values see the context from before the join, which is joined 
+    // once at the end, unless an enclosing map holds it too. As they only
+    // read it, values found through the index can be joined on threads
+    {
+      holdscope<dotctx> h(c);
+      if (h.was) // nested, the index is outdated by the joins of other values
+      {
+        indexed=false; dots.clear();
+        joinkeys(o,1,0L);
+      }
+      else
+        joinkeys(o,max(threads,1u),0);
+    }
+    c.join(o.c);
+    mark=c.changes;
+  }
+
+private:
+
+  template<typename W=V> // Adds the dots of v to the index, under key k
+  auto indexdots (const W & v, const N * k, int) -> 
+    decltype(v.eachdot(dotsink()), void())
+  {
+    v.eachdot(dotsink{this,k});
+  }
+
+  void indexdots (const V &, const N *, long) {}
+
+  // Values that list their dots join only the keys found through the index
+  template<typename W=V>
+  auto joinkeys (const ormap<N,V,K> & o, unsigned threads, int) -> 
+    decltype(declval<const W&>().eachdot(dotsink()), void())
+  {
+    if (! indexed || c.changes != mark) 
+    {
+      dots.clear();
+      for (const auto & kv : m) kv.second.eachdot(dotsink{this,&kv.first});
+    }
+    indexed=false; // until the keys joined below are indexed again
+
+    // The keys of the other map and the keys of the dots it knows of.
+    // Dots it knows of are dropped from the index, the ones that remain 
+    // are indexed again with the keys joined below
+    set<N> visit;
+    for (const auto & kv : o.m) visit.insert(visit.end(),kv.first);
+    for (const auto & ic : o.c.cc)
+    {
+      auto it=dots.lower_bound(pair<K,int>(ic.first,0));
+      while (it != dots.end() && it->first.first == ic.first && 
+        it->first.second <= ic.second)
+      {
+        visit.insert(it->second);
+        it=dots.erase(it);
+      }
+    }
+    for (const auto & d : o.c.dc)
     {
-      // need to collect erased dots, and list then in r context
-      V v;
-      v=m[n].reset();
-      r.c=v.context();
-      // now erase
-      m.erase(n);
+      auto it=dots.find(d);
+      if (it == dots.end()) continue;
+      visit.insert(it->second);
+      dots.erase(it);
     }
-    return r;
-  }
 
-  ormap<N,V,K> reset()
-  {
-    ormap<N,V,K> r;
-    if (! m.empty())
+    // Keys are added first, the values are then joined in place
+    vector<pair<V*,const V*> > work;
+    vector<const N*> keys; // of the work
+    for (const auto & k : visit)
     {
-      // need to collect erased dots, and list then in r context
-      for (auto & kv : m)
+      auto mito=o.m.find(k);
+      keys.push_back(&k);
+      if (mito != o.m.end()) // in both, or only at other
+        work.push_back(make_pair(&(*this)[k],&mito->second));
+      else
       {
-        V v;
-        v=kv.second.reset();
-        r.c.join(v.context());
+        auto mit=m.find(k);
+        if (mit == m.end()) // the dot was erased with its key
+        {
+          keys.pop_back(); 
+          continue; 
+        }
+        // entry only here, the other context might obsolete some dots
+        work.push_back(make_pair(&mit->second,(const V*)NULL));
       }
-      m.clear();
     }
-    return r;
+    size_t parts=min<size_t>(threads,work.size()/64+1); // not for a few keys
+    if (! sharedalloc<typename dotctx::template alloc<char> >::value) parts=1;
+    inparallel(parts,[&](size_t p)
+    {
+      for (size_t i=work.size()*p/parts; i < work.size()*(p+1)/parts; i++)
+        if (work[i].second != NULL) 
+          work[i].first->join(*work[i].second);
+        else
+        {
+          V empty(id,o.context());
+          work[i].first->join(empty);
+        }
+    });
+    for (size_t i=0; i < work.size(); i++)
+      work[i].first->eachdot(dotsink{this,keys[i]});
+    indexed=true;
   }
 
-
-  void join (const ormap<N,V> & o)
+  // Others walk all keys, on this thread
+  void joinkeys (const ormap<N,V,K> & o, unsigned, long)
   {
-    const dotcontext<K> ic=c; // need access to an immutable context
-
     // join all keys
     auto mit=m.begin(); auto mito=o.m.begin();
     do 
     {
-      // ---- debug
-      /*
-      cout << "key left ";
-      if (mit != m.end()) 
-        cout << mit->first;
-      else
-        cout << "[empty]";
-      cout << ", key rigth ";
-      if (mito != o.m.end()) 
-        cout << mito->first;
-      else
-        cout << "[empty]";
-      cout << endl;
-      */
       if (mit != m.end() && (mito == o.m.end() || mit->first < mito->first))
       {
-        //cout << "entry left\n";
         // entry only at here
         
         // creaty and empty payload with the other context, since it might   
         // obsolete some local entries. 
         V empty(id,o.context());
         mit->second.join(empty);
-        c=ic;
 
         ++mit;
       }
       else if (mito != o.m.end() && (mit == m.end() || mito->first < mit->first))
       {
-        // cout << "entry right\n";
         // entry only at other
 
         (*this)[mito->first].join(mito->second);
-        c=ic;
-
 
         ++mito;
       }
       else if ( mit != m.end() && mito != o.m.end() )
       {
-        // cout << "entry both\n";
         // in both
         (*this)[mito->first].join(mito->second);
-        c=ic;
 
         ++mit; ++mito;
       }
     } while (mit != m.end() || mito != o.m.end());
-    c.join(o.c);
+  }
+
+public:
+
+  // Wire encoding, the context is shared by all the entries so it is 
+  // encoded once, followed by the keys and the kernels of their values
+  void encode(wireout & w, bool ctx=true) const
+  {
+    if (ctx) c.encode(w);
+    w.uvarint(m.size());
+    for (const auto & kv : m)
+    {
+      ::encode(w,kv.first);
+      kv.second.encode(w,false);
+    }
+  }
+
+  void decode(wirein & r, bool ctx=true)
+  {
+    if (ctx) c.decode(r);
+    m.clear();
+    dots.clear(); indexed=false;
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      N k;
+      ::decode(r,k);
+      auto ins = m.insert(m.end(),pair<N,V>(k,V(id,c)));
+      ins->second.decode(r,false);
+    }
+  }
+};
+
+// Hash of a key that all replicas agree on, FNV-1a over its wire encoding.
+// std::hash differs between standard libraries, and between builds
+template<typename N>
+struct wirehash
+{
+  uint64_t operator()(const N & n) const
+  {
+    static thread_local wireout w; // reused, keys are hashed on every access
+    w.clear();
+    ::encode(w,n);
+    uint64_t h=14695981039346656037ULL;
+    for (unsigned char b : w.bytes()) { h^=b; h*=1099511628211ULL; }
+    return h;
+  }
+};
+
+// An ormap split by key hash into shards, each an ormap with its own 
+// context and lock, so that threads that write or join different shards 
+// do not wait on each other. A delta belongs to the shard of its key, and 
+// is joined into that shard of other replicas, with the same shard count 
+// and hash
+template<typename N, typename V, typename K=string, typename H=wirehash<N> >
+class shardedormap
+{
+  struct shard
+  {
+    mutable mutex mu;
+    ormap<N,V,K> m;
+    shard(K id) : m(id) {}
+  };
+
+  deque<shard> s; // Never moved, the locks and contexts stay in place
 
+public:
+  shardedormap(K id, size_t n=16)
+  {
+    assert (n > 0);
+    for (size_t i=0; i < n; i++) s.emplace_back(id);
+  }
+
+  size_t shards() const { return s.size(); }
+
+  size_t shardof(const N & n) const { return H()(n) % s.size(); }
+
+  friend ostream &operator<<( ostream &output, const shardedormap<N,V,K,H>& o)
+  { 
+    for (size_t i=0; i < o.s.size(); i++)
+    {
+      lock_guard<mutex> lock(o.s[i].mu);
+      output << "Shard " << i << ":" << o.s[i].m;
+    }
+    return output;            
+  }
+
+  template<typename F> // Calls f on the value of n, holding its shard
+  auto at(const N & n, F f) -> decltype(f(declval<V&>()))
+  {
+    shard & sh=s[shardof(n)];
+    lock_guard<mutex> lock(sh.mu);
+    return f(sh.m[n]);
+  }
+
+  template<typename F> // The delta of shard shardof(n), see ormap::apply
+  ormap<N,V,K> apply(const N & n, F f)
+  {
+    shard & sh=s[shardof(n)];
+    lock_guard<mutex> lock(sh.mu);
+    return sh.m.apply(n,f);
   }
 
+  ormap<N,V,K> erase(const N & n) // The delta of shard shardof(n)
+  {
+    shard & sh=s[shardof(n)];
+    lock_guard<mutex> lock(sh.mu);
+    return sh.m.erase(n);
+  }
+
+  // A delta of shard i, false if there is no such shard or if it has keys
+  // of other shards, that would be shadowed there
+  bool join(size_t i, const ormap<N,V,K> & d)
+  {
+    if (i >= s.size()) return false;
+    bool routed=true;
+    d.eachkey([&](const N & n) { routed = routed && shardof(n) == i; });
+    if (! routed) return false;
+    lock_guard<mutex> lock(s[i].mu);
+    s[i].m.join(d);
+    return true;
+  }
+
+  void join(const shardedormap<N,V,K,H> & o) // Shard by shard
+  {
+    if (this == &o) return;
+    assert (o.s.size() == s.size());
+    for (size_t i=0; i < s.size(); i++)
+    {
+      unique_lock<mutex> l1(s[i].mu,defer_lock), l2(o.s[i].mu,defer_lock);
+      lock(l1,l2); // in any order, for joins both ways at once
+      s[i].m.join(o.s[i].m);
+    }
+  }
+
+  // Wire encoding, the shard count and then each shard
+  void encode(wireout & w) const
+  {
+    w.uvarint(s.size());
+    for (const auto & sh : s)
+    {
+      lock_guard<mutex> lock(sh.mu);
+      sh.m.encode(w);
+    }
+  }
 
+  void decode(wirein & r)
+  {
+    if (r.count() != s.size()) { r.fail(); return; }
+    for (auto & sh : s)
+    {
+      lock_guard<mutex> lock(sh.mu);
+      sh.m.decode(r);
+    }
+  }
 };
 
 // A bag is similar to an RWSet, but allows for CRDT payloads
-template<typename V, typename K=string>
+template<typename V, typename K=string, typename S=mapstore>
 class bag 
 {
 private:
-  dotkernel<V,K> dk; // Dot kernel
+  dotkernel<V,K,S> dk; // Dot kernel
   K id;
+  pair<K,int> own; // Newest dot of id, unset by join, reset and decode
 
 public:
 
   bag() {} // Only for deltas and those should not be mutated
   bag(K k) : id(k) {} // Mutable replicas need a unique id
-  bag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {} 
+  bag(K k, typename S::template context<K> &jointc) : id(k), dk(jointc) {} 
+
+  typedef dotkernelview<V,K> view; // Encoded deltas, see joinbytes
 
-  bag<V,K> & operator=(const bag<V,K> & o)
+  bag<V,K,S> & operator=(const bag<V,K,S> & o)
   {
     if (&o == this) return *this;
     if (&dk != &o.dk) dk=o.dk; 
     id=o.id;
+    own=o.own;
     return *this;
   }
 
 
-  dotcontext<K> & context()
+  typename S::template context<K> & context()
   {
     return dk.c;
   }
 
+  template<typename F> void eachdot (F f) const { dk.eachdot(f); } // see ormap
+
   void insert(pair<pair<K,int>,V> t)
   {
     dk.ds.insert(pair<pair<K,int>,V>(t));
     dk.c.insertdot(t.first);
   }
 
-  friend ostream &operator<<( ostream &output, const bag<V,K>& o)
+  friend ostream &operator<<( ostream &output, const bag<V,K,S>& o)
   { 
     output << "Bag:" << o.dk;
     return output;            
   }
 
-  typename map<pair<K,int>,V>::iterator begin()
+  typename dotkernel<V,K,S>::dotstore::iterator begin()
   {
     return dk.ds.begin();
   }
 
-  typename map<pair<K,int>,V>::iterator end()
+  typename dotkernel<V,K,S>::dotstore::iterator end()
   {
     return dk.ds.end();
   }
 
-  pair<K,int> mydot()
+  // Entry of the newest dot of this replica, making one if there is none
+  typename dotkernel<V,K,S>::dotstore::iterator mine()
   {
     auto me = dk.ds.end();
-    for (auto it=dk.ds.begin(); it!=dk.ds.end(); ++it)
-    {
-      if (it->first.first == id) // a candidate
-      {
-        if (me==dk.ds.end()) // pick at least one valid
-          me=it;
-        else // need to switch if more recent
-        {
-          if (it->first.second > me->first.second)
-            me=it;
-        }
-      }
-    }
-    if (me != dk.ds.end())
-      return me->first;
-    else 
+    if (own.second != 0) me=dk.ds.find(own);
+    if (me != dk.ds.end()) return me;
+    // Not tracked, the dots of id end before (id,max)
+    me=dk.ds.lower_bound(pair<K,int>(id,numeric_limits<int>::max()));
+    if (me != dk.ds.begin() && prev(me)->first.first == id) 
     {
-      fresh();
-      return mydot(); // After a fresh it must be found
+      own=prev(me)->first;
+      return prev(me);
     }
+    fresh();
+    return dk.ds.find(own);
+  }
+
+  pair<K,int> mydot()
+  {
+    return mine()->first;
   }
 
   V & mydata()
   {
-    auto me = dk.ds.end();
-    for (auto it=dk.ds.begin(); it!=dk.ds.end(); ++it)
-    {
-      if (it->first.first == id) // a candidate
-      {
-        if (me==dk.ds.end()) // pick at least one valid
-          me=it;
-        else // need to switch if more recent
-        {
-          if (it->first.second > me->first.second)
-            me=it;
-        }
-      }
-    }
-    if (me != dk.ds.end())
-      return me->second;
-    else 
-    {
-      fresh();
-      return mydata(); // After a fresh it must be found
-    }
+    return mine()->second;
   }
 
   // To protect from concurrent removes, create fresh dot for self
   void fresh()
   {
-    dk.add(id,V());
+    own=dk.dotadd(id,V());
   }
 
-  bag<V,K> reset()
+  bag<V,K,S> reset()
   {
-    bag<V,K> r;
+    bag<V,K,S> r;
     r.dk=dk.rmv(); 
+    own=pair<K,int>();
     return r;
   }
 
   // Using the deep join will try to join different payloads under same dot
-  void join (const bag<V,K> & o)
+  void join (const bag<V,K,S> & o)
   {
     dk.deepjoin(o.dk);
+    own=pair<K,int>();
+  }
+
+  void join (bag<V,K,S> && o)
+  {
+    dk.deepjoin(std::move(o.dk));
+    own=pair<K,int>();
   }
+
+  void join (const view & o)
+  {
+    dk.deepjoin(o);
+    own=pair<K,int>();
+  }
+
+  void encode(wireout & w, bool ctx=true) const { dk.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { dk.decode(r,ctx); own=pair<K,int>(); }
 };
 
 // Inspired by designs from Carl Lerche and Paulo S. Almeida
-template<typename V, typename K=string>
+template<typename V, typename K=string, typename S=mapstore>
 class rwcounter    //  Reset Wins Counter
 {
 private:
-  bag<pair<V,V>,K> b; // Bag of pairs
+  bag<pair<V,V>,K,S> b; // Bag of pairs
   K id;
 
 public:
   rwcounter() {} // Only for deltas and those should not be mutated
   rwcounter(K k) : id(k), b(k) {} // Mutable replicas need a unique id
-  rwcounter(K k, dotcontext<K> &jointc) : id(k), b(k,jointc) {} 
+  rwcounter(K k, typename S::template context<K> &jointc) : id(k), b(k,jointc) {} 
 
-  rwcounter<V,K> & operator=(const rwcounter<V,K> & o)
+  rwcounter<V,K,S> & operator=(const rwcounter<V,K,S> & o)
   {
     if (&o == this) return *this;
     if (&b != &o.b) b=o.b; 
@@ -1640,36 +4665,40 @@ public:
     return *this;
   }
 
-  dotcontext<K> & context()
+  typename S::template context<K> & context()
   {
     return b.context();
   }
 
-  friend ostream &operator<<( ostream &output, const rwcounter<V,K>& o)
+  template<typename F> void eachdot (F f) const { b.eachdot(f); } // see ormap
+
+  friend ostream &operator<<( ostream &output, const rwcounter<V,K,S>& o)
   { 
     output << "ResetWinsCounter:" << o.b;
     return output;            
   }
   
-  rwcounter<V,K> inc (const V& val=1) 
+  rwcounter<V,K,S> inc (const V& val=1) 
   {
-    rwcounter<V,K> r;
-    b.mydata().first+=val;
-    r.b.insert(pair<pair<K,int>,pair<V,V>>(b.mydot(),b.mydata()));
+    rwcounter<V,K,S> r;
+    auto me=b.mine();
+    me->second.first+=val;
+    r.b.insert(pair<pair<K,int>,pair<V,V>>(me->first,me->second));
     return r;
   }
 
-  rwcounter<V,K> dec (const V& val=1) 
+  rwcounter<V,K,S> dec (const V& val=1) 
   {
-    rwcounter<V,K> r;
-    b.mydata().second+=val;
-    r.b.insert(pair<pair<K,int>,pair<V,V>>(b.mydot(),b.mydata()));
+    rwcounter<V,K,S> r;
+    auto me=b.mine();
+    me->second.second+=val;
+    r.b.insert(pair<pair<K,int>,pair<V,V>>(me->first,me->second));
     return r;
   }
 
-  rwcounter<V,K> reset()
+  rwcounter<V,K,S> reset()
   {
-    rwcounter<V,K> r;
+    rwcounter<V,K,S> r;
     r.b=b.reset();
     return r;
   }
@@ -1690,35 +4719,40 @@ public:
     return ac.first - ac.second;
   }
 
-  void join(const rwcounter<V,K> & o)
+  void join(const rwcounter<V,K,S> & o)
   {
     b.join(o.b);
   }
 
+
+  void encode(wireout & w, bool ctx=true) const { b.encode(w,ctx); }
+
+  void decode(wirein & r, bool ctx=true) { b.decode(r,ctx); }
 };
 
-template<typename N, typename V>
+template<typename N, typename V, template<typename> class A=allocator>
 class gmap
 {
   
   public:
   // later make m private by adding a begin() for iterators 
-  map<N,V> m;  
+  map<N,V,less<N>,A<pair<const N,V> > > m;  
 
-  friend ostream &operator<<( ostream &output, const gmap<N,V>& o)
+  friend ostream &operator<<( ostream &output, const gmap<N,V,A>& o)
   { 
     output << "GMap:" << endl;
     for (const auto & kv : o.m)
-      cout << kv.first << "->" << kv.second << endl;
+      output << kv.first << "->" << kv.second << endl;
     return output;            
   }
 
-  // Need to find a better way to collect deltas for this interface
+  // Mutations through the reference are not collected in a delta, see apply
   V& operator[] (const N& n)
   {
     auto i = m.find(n);
     if (i == m.end()) // 1st key access
     {
+      allocscope<decltype(m.get_allocator())> as(m.get_allocator());
       auto ins = m.insert(i,pair<N,V>(n,V()));
       return ins->second;
 
@@ -1729,7 +4763,17 @@ class gmap
     }
   }
 
-  void join (const gmap<N,V> & o)
+  // Applies a mutator to the value of a key, f(V&) returning its delta, 
+  // and returns that delta under the key, as a map delta
+  template<typename F>
+  gmap<N,V,A> apply(const N & n, F f)
+  {
+    gmap<N,V,A> r;
+    r[n]=f((*this)[n]);
+    return r;
+  }
+
+  void join (const gmap<N,V,A> & o)
   {
     // join all keys
     auto mit=m.begin(); auto mito=o.m.begin();
@@ -1763,17 +4807,32 @@ class gmap
 
   }
 
+
+  void encode(wireout & w) const { ::encode(w,m); }
+
+  void decode(wirein & r) { ::decode(r,m); }
 };
 
 
-template <typename V=int, typename K=string>
+template <typename V=int, typename K=string, template<typename> class A=allocator>
 class bcounter
 {
 private:
-  pncounter<V,K> c;
-  gmap<pair<K,K>,int> m; 
+  pncounter<V,K,A> c;
+  gmap<pair<K,K>,int,A> m; 
+  V in=0, out=0; // Flows into and out of id, kept up to date by mv and join
   K id;
 
+  void flows() // recompute in and out from m
+  {
+    in=0; out=0;
+    for (const auto & kv : m.m)
+    {
+      if (kv.first.second==id) in+=kv.second;
+      if (kv.first.first==id) out+=kv.second;
+    }
+  }
+
 public:
 
   bcounter() {} // Only for deltas and those should not be mutated
@@ -1781,14 +4840,14 @@ public:
 
   bcounter inc(V tosum={1}) // Argument is optional
   {
-    bcounter<V,K> res;
+    bcounter<V,K,A> res;
     res.c = c.inc(tosum); 
     return res;
   }
 
   bcounter dec(V todec={1}) // Argument is optional
   {
-    bcounter<V,K> res;
+    bcounter<V,K,A> res;
     if (todec <= local()) // Check local capacity
       res.c = c.dec(todec); 
     return res;
@@ -1796,11 +4855,14 @@ public:
 
   bcounter mv(V q, K to) // Quantity V to node id K
   {
-    bcounter<V,K> res;
+    bcounter<V,K,A> res;
     if (q <= local()) // Check local capacity
     {
-      m[pair<K,K>(id,to)]+=q; 
-      res.m[pair<K,K>(id,to)]=m[pair<K,K>(id,to)];
+      int & f=m[pair<K,K>(id,to)];
+      f+=q; 
+      out+=q;
+      if (to == id) in+=q;
+      res.m[pair<K,K>(id,to)]=f;
     }
     return res;
   }
@@ -1813,41 +4875,51 @@ public:
 
   V local() // get local counter available value
   {
-    V res=c.local();
-    // Sum incoming flows
-    for (const auto & kv : m.m)
-      if (kv.first.second==id) res+=kv.second;
-    // Subtract outgoing flows
-    for (const auto & kv : m.m)
-      if (kv.first.first==id) res-=kv.second;
+    V res=c.local()+in-out;
     return res;
   }
 
   void join(const bcounter& o)
   {
     c.join(o.c);
+    for (const auto & kv : o.m.m) // flows of id that the join raises
+      if (kv.first.first==id || kv.first.second==id)
+      {
+        auto it=m.m.find(kv.first);
+        int before = it == m.m.end() ? 0 : it->second;
+        if (before >= kv.second) continue;
+        if (kv.first.second==id) in+=kv.second-before;
+        if (kv.first.first==id) out+=kv.second-before;
+      }
     m.join(o.m);
   }
 
-  friend ostream &operator<<( ostream &output, const bcounter<V,K>& o)
+  friend ostream &operator<<( ostream &output, const bcounter<V,K,A>& o)
   { 
     output << "BCounter:C:" << o.c << "BCounter:M:" << o.m;
     return output;            
   }
 
+
+  void encode(wireout & w) const { c.encode(w); m.encode(w); }
+
+  void decode(wirein & r) { c.decode(r); m.decode(r); flows(); }
 };
 
-template<typename T=char, typename I=string>
+template<typename T=char, typename I=string, 
+  template<typename> class A=allocator>
 class orseq
 {
 private:
 
   // List elements are: (position,dot,payload)
-  list<tuple<vector<bool>,pair<I,int>,T>> l;
+  typedef list<tuple<vector<bool>,pair<I,int>,T>,
+    A<tuple<vector<bool>,pair<I,int>,T> > > seqlist;
+  seqlist l;
   I id;  
 
-  dotcontext<I> cbase;
-  dotcontext<I> & c;
+  dotcontext<I,A> cbase;
+  dotcontext<I,A> & c;
 
 public:
 
@@ -1855,9 +4927,11 @@ public:
   orseq() : c(cbase) {}  // Only for deltas and those should not be mutated
   orseq(I i) : id(i), c(cbase) {} 
   // if supplied, use a shared causal context
-  orseq(I i,dotcontext<I> &jointc) : id(i), c(jointc) {} 
+  orseq(I i,dotcontext<I,A> &jointc) : id(i), c(jointc) {} 
+  orseq(const orseq<T,I,A> & aos) : l(aos.l), id(aos.id), cbase(aos.cbase),
+    c(&aos.c == &aos.cbase ? cbase : aos.c) {}
 
-  orseq<T,I> & operator=(const orseq<T,I> & aos)
+  orseq<T,I,A> & operator=(const orseq<T,I,A> & aos)
   {
     if (&aos == this) return *this;
     if (&c != &aos.c) c=aos.c; 
@@ -1866,7 +4940,7 @@ public:
     return *this;
   }
 
-  friend ostream &operator<<( ostream &output, const orseq<T,I>& o)
+  friend ostream &operator<<( ostream &output, const orseq<T,I,A>& o)
   { 
     output << "ORSeq: " << o.c;
     output << " List:"; 
@@ -1876,19 +4950,19 @@ public:
     return output;            
   }
 
-  typename list<tuple<vector<bool>,pair<I,int>,T>>::iterator begin() 
+  typename seqlist::iterator begin() 
   {
     return l.begin();
   }
 
-  typename list<tuple<vector<bool>,pair<I,int>,T>>::iterator end() 
+  typename seqlist::iterator end() 
   {
     return l.end();
   }
 
-  orseq<T,I> erase (typename list<tuple<vector<bool>,pair<I,int>,T>>::iterator i)
+  orseq<T,I,A> erase (typename seqlist::iterator i)
   {
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     if (i != l.end())
     {
       res.c.insertdot(get<1>(*i));
@@ -1897,23 +4971,28 @@ public:
     return res;
   }
 
-  dotcontext<I> & context()
+  dotcontext<I,A> & context()
   {
     return c;
   }
 
-  orseq<T,I> reset ()
+  template<typename F> void eachdot (F f) const // see ormap
+  {
+    for (const auto & e : l) f(get<1>(e));
+  }
+
+  orseq<T,I,A> reset ()
   {
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     for (auto const & t : l)
       res.c.insertdot(get<1>(t));
     l.clear();
     return res;
   }
 
-  orseq<T,I> insert (typename list<tuple<vector<bool>,pair<I,int>,T>>::iterator i, const T & val)
+  orseq<T,I,A> insert (typename seqlist::iterator i, const T & val)
   {
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     if (i == l.end())
       res=push_back(val);
     else
@@ -1921,7 +5000,7 @@ public:
         res=push_front(val);
       else
       {
-        typename list<tuple<vector<bool>,pair<I,int>,T>>::iterator j=i;
+        typename seqlist::iterator j=i;
         j--;
         vector<bool> bl,br,pos;
         bl=get<0>(*j);
@@ -1939,11 +5018,11 @@ public:
   }
 
   // add 1st element
-  orseq<T,I> makefirst(const T & val)
+  orseq<T,I,A> makefirst(const T & val)
   {
     assert(l.empty());
 
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     vector<bool> bl,br,pos;
     bl.push_back(false);
     br.push_back(true);
@@ -1957,9 +5036,9 @@ public:
     return res;
   }
 
-  orseq<T,I> push_back (const T & val)
+  orseq<T,I,A> push_back (const T & val)
   {
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     if (l.empty())
       res=makefirst(val);
     else
@@ -1979,9 +5058,9 @@ public:
     return res;
   }
 
-  orseq<T,I> push_front (const T & val)
+  orseq<T,I,A> push_front (const T & val)
   {
-    orseq<T,I> res;
+    orseq<T,I,A> res;
     if (l.empty())
       res=makefirst(val);
     else
@@ -2001,9 +5080,10 @@ public:
     return res;
   }
 
-  void join (const orseq<T,I> & o)
+  void join (const orseq<T,I,A> & o)
   {
     if (this == &o) return; // Join is idempotent, but just don't do it.
+    bool dropped=false;
     auto it=l.begin(); auto ito=o.l.begin();
     pair<vector<bool>,I> e,eo;
     do 
@@ -2023,7 +5103,10 @@ public:
         // cout << "ds one\n";
         // entry only at this
         if (o.c.dotin(get<1>(*it))) // other knows dot, must delete here 
+        {
           l.erase(it++);
+          dropped=true;
+        }
         else // keep it
           ++it;
       }
@@ -2044,10 +5127,308 @@ public:
         ++it; ++ito;
       }
     } while (it != l.end() || ito != o.l.end() );
+    if (dropped) c.changes++;
     // CC
     c.join(o.c);
 
   }
 
+
+  // Wire encoding, the context and then the list elements in order
+  void encode(wireout & w, bool ctx=true) const
+  {
+    if (ctx) c.encode(w);
+    w.uvarint(l.size());
+    for (const auto & t : l)
+    {
+      ::encode(w,get<0>(t));
+      w.id(get<1>(t).first);
+      ::encode(w,get<1>(t).second);
+      ::encode(w,get<2>(t));
+    }
+  }
+
+  void decode(wirein & r, bool ctx=true)
+  {
+    if (ctx) c.decode(r);
+    l.clear();
+    // The merge walk of join needs entries ordered by (position,id)
+    pair<vector<bool>,I> prev, e; bool first=true;
+    for (size_t n=r.count(); n > 0 && r.good(); n--)
+    {
+      tuple<vector<bool>,pair<I,int>,T> t;
+      ::decode(r,get<0>(t));
+      r.id(get<1>(t).first);
+      ::decode(r,get<1>(t).second);
+      ::decode(r,get<2>(t));
+      e.first=get<0>(t); e.second=get<1>(t).first;
+      if (! first && ! (prev < e)) r.fail();
+      if (! r.good()) break;
+      l.push_back(t);
+      swap(prev,e); first=false;
+    }
+  }
+};
+
+
+// Contexts of datatypes that have one are deferred while in a batch
+template<typename T> 
+auto defercontext(T & t, bool on, int) -> decltype(t.context(), void())
+{
+  t.context().defer(on);
+}
+
+template<typename T> 
+void defercontext(T &, bool, long) {}
+
+// Coalesces many deltas into one. Joining each small delta into a growing
+// one walks the growing one every time, so deltas are instead merged 
+// pairwise, as in a binary counter, with contexts compacted only on close.
+//   deltabatch<aworset<int>> b;
+//   for (int i=0; i < 1000; i++) b.add(x.add(i));
+//   aworset<int> d=b.close();
+template<typename T>
+class deltabatch
+{
+private:
+  deque<T> parts; // In place, maps should not be copy constructed
+  vector<size_t> sizes; // Deltas merged in each part, decreasing
+
+  void merge() // Join the last part into the one before it
+  {
+    parts[parts.size()-2].join(parts.back());
+    sizes[sizes.size()-2]+=sizes.back();
+    parts.pop_back(); sizes.pop_back();
+  }
+
+public:
+  size_t size() const 
+  { 
+    size_t n=0;
+    for (auto s : sizes) n+=s;
+    return n;
+  }
+
+  bool empty() const { return parts.empty(); }
+
+  void add(const T & delta)
+  {
+    parts.emplace_back();
+    defercontext(parts.back(),true,0);
+    parts.back().join(delta);
+    sizes.push_back(1);
+    while (sizes.size() > 1 && sizes[sizes.size()-2] == sizes.back()) 
+      merge();
+  }
+
+  T close() // The join of all deltas added, leaving the batch empty
+  {
+    T res;
+    while (parts.size() > 1) merge();
+    defercontext(res,true,0);
+    if (! parts.empty()) res.join(parts.front()); // maps can not be copied
+    defercontext(res,false,0);
+    parts.clear(); sizes.clear();
+    return res;
+  }
+};
+
+// Delta-interval anti-entropy, for any datatype above. Deltas from local 
+// operations, and from peers, are kept in a buffer under sequence numbers.
+// Each peer is shipped the join of the deltas it has not acknowledged, 
+// skipping those it sent, or the full state if some of those were already 
+// collected. 
+template<typename T, typename K=string>
+class replicator
+{
+private:
+  K id;
+  T x; // Replica state
+  int c=0; // Sequence number of the next delta
+  map<int,pair<K,T> > d; // Delta buffer, with the replica each came from
+  map<K,int> a; // Per peer, sequence numbers up to this were acknowledged
+
+  enum { deltamsg=0, ackmsg=1 };
+
+  void store(const K & origin, const T & delta)
+  {
+    auto & e=d[c++]; // default constructed and assigned, not copied
+    e.first=origin;
+    e.second=delta;
+  }
+
+  // Joins d into s, and answers if that changed s. Datatypes with a causal
+  // context count their changes in it, others are told by their encoding, 
+  // that is canonical
+  template<typename U>
+  static auto inflate(U & s, const U & d, int) -> 
+    decltype(s.context().changes.load(),bool())
+  {
+    size_t before=s.context().changes;
+    s.join(d);
+    return s.context().changes != before;
+  }
+
+  template<typename U>
+  static bool inflate(U & s, const U & d, long)
+  {
+    string before=serialize(s);
+    s.join(d);
+    return serialize(s) != before;
+  }
+
+public:
+  replicator(const K & k) : id(k), x(k) {} // For datatypes with replica ids
+  replicator(const K & k, const T & init) : id(k) { x=init; }
+
+  const K & name() const { return id; }
+  const T & state() const { return x; }
+  size_t buffered() const { return d.size(); }
+
+  // Apply f, that mutates the state and returns a delta, as in 
+  // r.operate([](aworset<int> & s){ return s.add(1); })
+  template<typename F>
+  T operate(F f)
+  {
+    T delta;
+    delta=f(x);
+    store(id,delta);
+    return delta;
+  }
+
+  void addpeer(const K & j) { a.insert(pair<K,int>(j,0)); }
+
+  vector<K> peers() const
+  {
+    vector<K> res;
+    for (const auto & ja : a) res.push_back(ja.first);
+    return res;
+  }
+
+  // Message for peer j, empty if it is known to be up to date
+  string ship(const K & j)
+  {
+    int from=a[j];
+    if (from == c) return string();
+    vector<const T*> news; // Not known to have reached j
+    if (! d.empty() && d.begin()->first <= from)
+    {
+      for (auto it=d.lower_bound(from); it != d.end(); ++it)
+        if (it->second.first != j) news.push_back(&it->second.second);
+      if (news.empty()) // all came from j
+      {
+        a[j]=c;
+        gc();
+        return string();
+      }
+    }
+    wireout w;
+    w.byte(wiremagic);
+    w.byte(wireversion);
+    w.byte(deltamsg);
+    ::encode(w,c);
+    if (news.empty()) // gone, ship all
+      ::encode(w,x);
+    else if (news.size() == 1)
+      ::encode(w,*news.front());
+    else
+    {
+      deltabatch<T> interval;
+      for (auto dp : news) interval.add(*dp);
+      ::encode(w,interval.close());
+    }
+    return w.bytes();
+  }
+
+  // Handle a message from peer j, returns the reply to it, if any
+  string receive(const K & j, const string & m)
+  {
+    wirein r(m);
+    if (! wireheader(r)) return string();
+    unsigned char kind=r.byte();
+    int n;
+    ::decode(r,n);
+    if (kind == ackmsg)
+    {
+      if (! r.good() || r.left() != 0) return string();
+      auto ait=a.insert(pair<K,int>(j,0)).first;
+      ait->second=max(ait->second,min(n,c));
+      gc();
+      return string();
+    }
+    T delta;
+    ::decode(r,delta);
+    if (kind != deltamsg || ! r.good() || r.left() != 0) return string();
+    // Only inflations are buffered, to be forwarded
+    if (inflate(x,delta,0)) store(j,delta);
+    wireout w;
+    w.byte(wiremagic);
+    w.byte(wireversion);
+    w.byte(ackmsg);
+    ::encode(w,n);
+    return w.bytes();
+  }
+
+  // Drop the deltas that all peers acknowledged
+  void gc()
+  {
+    int low=c;
+    for (const auto & ja : a) low=min(low,ja.second);
+    d.erase(d.begin(),d.lower_bound(low));
+  }
 };
 
+// In process transport, for testing replicators. Messages wait in flight 
+// until delivered, and can be lost, duplicated or reordered on the way.
+template<typename T, typename K=string>
+class loopback
+{
+private:
+  struct message { K from, to; string bytes; };
+  map<K,replicator<T,K>*> nodes;
+  deque<message> inflight;
+
+public:
+  size_t sent=0, bytes=0;
+
+  void attach(replicator<T,K> & r) { nodes[r.name()]=&r; }
+
+  // Peers i and j gossip with each other
+  void link(const K & i, const K & j)
+  {
+    nodes.at(i)->addpeer(j);
+    nodes.at(j)->addpeer(i);
+  }
+
+  void send(const K & from, const K & to, const string & m)
+  {
+    if (m.empty()) return;
+    inflight.push_back(message{from,to,m});
+    sent++; bytes+=m.size();
+  }
+
+  // Every replica ships to all its peers
+  void gossip()
+  {
+    for (const auto & in : nodes)
+      for (const auto & j : in.second->peers())
+        send(in.first,j,in.second->ship(j));
+  }
+
+  size_t pending() const { return inflight.size(); }
+
+  void lose() { if (! inflight.empty()) inflight.pop_front(); }
+  void duplicate() { if (! inflight.empty()) inflight.push_back(inflight.front()); }
+  void reorder() { if (! inflight.empty()) { inflight.push_back(inflight.front()); inflight.pop_front(); } }
+
+  // Deliver the oldest message, replies go back in flight
+  void step()
+  {
+    if (inflight.empty()) return;
+    message m=inflight.front();
+    inflight.pop_front();
+    send(m.to,m.from,nodes.at(m.to)->receive(m.from,m.bytes));
+  }
+
+  void run() { while (! inflight.empty()) step(); }
+};
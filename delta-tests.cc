@@ -33,13 +33,65 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 //#define NDEBUG  // Uncoment do stop testing asserts
 #include <assert.h>
 #include "delta-crdts.cc"
 
 using namespace std;
 
+// Allocation accounting for the benchmarks
+atomic<size_t> alloc_count(0), alloc_bytes(0); // threads allocate too
+
+// Not inlined, so that the compiler does not pair the free below with the
+// new expressions of the callers
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void * operator new(size_t n, const nothrow_t &) noexcept
+{
+  alloc_count.fetch_add(1,memory_order_relaxed); 
+  alloc_bytes.fetch_add(n,memory_order_relaxed);
+  return malloc(n == 0 ? 1 : n);
+}
+
+NOINLINE void * operator new(size_t n)
+{
+  void * p=operator new(n,nothrow);
+  if (p == NULL) throw bad_alloc();
+  return p;
+}
+
+NOINLINE void operator delete(void * p) noexcept
+{
+  free(p);
+}
+
+// The other forms, so that all of them pair with the ones above
+void * operator new[](size_t n) { return operator new(n); }
+void * operator new[](size_t n, const nothrow_t & t) noexcept 
+{ 
+  return operator new(n,t); 
+}
+void operator delete[](void * p) noexcept { operator delete(p); }
+void operator delete(void * p, const nothrow_t &) noexcept { operator delete(p); }
+void operator delete[](void * p, const nothrow_t &) noexcept 
+{ 
+  operator delete(p); 
+}
+#if defined(__cpp_sized_deallocation)
+void operator delete(void * p, size_t) noexcept { operator delete(p); }
+void operator delete[](void * p, size_t) noexcept { operator delete(p); }
+#endif
+
 void test_gset()
 {
   cout << "--- Testing: gset --\n";
@@ -155,6 +207,35 @@ void test_lexcounter()
 }
 
 
+void test_dotcontext()
+{
+  cout << "--- Testing: dotcontext --\n";
+  dotcontext<string> c1,c2;
+
+  // Out of order dots stay in the cloud until the gaps are filled
+  c1.insertdot(pair<string,int>("x",5));
+  c1.insertdot(pair<string,int>("x",3));
+  c1.insertdot(pair<string,int>("y",2));
+  c1.insertdot(pair<string,int>("x",4));
+  cout << c1 << endl;
+  assert (c1.cc.empty() && c1.dc.size() == 4);
+  c1.insertdot(pair<string,int>("x",1));
+  c1.insertdot(pair<string,int>("x",2));
+  cout << c1 << endl;
+  assert (c1.cc.at("x") == 5 && c1.dc.size() == 1);
+
+  // Dominated dots are pruned and runs from several ids absorbed in one go
+  c2.insertdot(pair<string,int>("x",2),false);
+  c2.insertdot(pair<string,int>("y",1),false);
+  c2.insertdot(pair<string,int>("x",7),false);
+  c2.insertdot(pair<string,int>("z",3),false);
+  c1.join(c2);
+  cout << c1 << endl;
+  assert (c1.cc.at("x") == 5 && c1.cc.at("y") == 2);
+  assert (c1.dc.size() == 2 && c1.dotin(pair<string,int>("z",3)));
+  assert (! c1.dotin(pair<string,int>("x",6)));
+}
+
 void test_aworset()
 {
   cout << "--- Testing: aworset --\n";
@@ -182,6 +263,1251 @@ void test_aworset()
   cout << o5 << endl;
 }
 
+void test_flatstore()
+{
+  cout << "--- Testing: aworset on flat dot store --\n";
+  aworset<int,string> mx("x"),my("y");
+  aworset<int,string,flatstore> fx("x"),fy("y");
+
+  srand(42);
+  for (int i=0; i < 2000; i++)
+  {
+    int v=rand()%50;
+    switch (rand()%5)
+    {
+      case 0: mx.add(v); fx.add(v); break;
+      case 1: my.add(v); fy.add(v); break;
+      case 2: mx.rmv(v); fx.rmv(v); break;
+      case 3: my.rmv(v); fy.rmv(v); break;
+      case 4: 
+        if (v%2) { mx.join(my); fx.join(fy); }
+        else { my.join(mx); fy.join(fx); }
+        break;
+    }
+    assert (mx.read() == fx.read() && my.read() == fy.read());
+  }
+  mx.join(my); fx.join(fy);
+  assert (mx.read() == fx.read());
+  cout << fx.read() << endl;
+
+  // Deep joins merge payloads under the same dot
+  bag<pair<int,int>,string,flatstore> b("i"),c("j");
+  b.mydata().first=1;
+  c.join(b);
+  b.mydata().first=3;
+  c.mydata().second=2;
+  b.join(c);
+  cout << b << endl;
+  assert (b.mydata() == (pair<int,int>(3,0)));
+}
+
+template<typename S>
+void test_valueindex_on()
+{
+  aworset<int,string,S> x("x"),y("y");
+
+  srand(7);
+  for (int i=0; i < 1000; i++)
+  {
+    int v=rand()%20;
+    switch (rand()%4)
+    {
+      case 0: x.add(v); break;
+      case 1: y.add(v); break;
+      case 2: x.rmv(v); break;
+      case 3: if (v%2) x.join(y); else y.join(x); break;
+    }
+    set<int> rx=x.read(), ry=y.read();
+    for (int e=0; e < 20; e++)
+      assert (x.in(e) == (rx.count(e) == 1) && y.in(e) == (ry.count(e) == 1));
+  }
+
+  // Deep joins replace payloads under a dot, and the index follows
+  dotkernel<int,string,S,true> a,b;
+  auto d=a.dotadd("a",1);
+  b.join(a);
+  a.ds.find(d)->second=5; // bypasses the index, so fix it by hand
+  a.vi.erase(1,d); a.vi.insert(5,d);
+  b.deepjoin(a);
+  assert (b.in(5) && ! b.in(1));
+  b.rmv(5);
+  assert (! b.in(5) && b.ds.empty());
+}
+
+void test_valueindex()
+{
+  cout << "--- Testing: dotkernel value index --\n";
+  test_valueindex_on<mapstore>();
+  test_valueindex_on<flatstore>();
+}
+
+template<typename T> // Pretty printed form, to compare replicas
+string printed(const T & o)
+{
+  ostringstream os;
+  os << o;
+  return os.str();
+}
+
+template<typename T> // Encode, decode into back and check nothing is lost
+void roundtrip(const T & o, T & back)
+{
+  string b=serialize(o);
+  bool ok=deserialize(b,back);
+  assert (ok && printed(o) == printed(back));
+  // Any truncated message must be rejected
+  for (size_t n=0; n < b.size(); n++)
+  {
+    T t;
+    assert (! deserialize(b.substr(0,n),t));
+  }
+}
+
+void test_wire()
+{
+  cout << "--- Testing: wire format --\n";
+  gset<string> gs,gs2; gs.add("hello"); gs.add("world");
+  roundtrip(gs,gs2);
+
+  twopset<int> tp,tp2; tp.add(-1); tp.add(300); tp.rmv(-1);
+  roundtrip(tp,tp2);
+
+  gcounter<> gc("x"),gc2; gc.inc(1000); gc.join(gcounter<>("y").inc(2));
+  roundtrip(gc,gc2);
+
+  pncounter<float,int> pn(2),pn2; pn.inc(3.5); pn.dec(0.25);
+  roundtrip(pn,pn2);
+  assert (pn2.read() == pn.read());
+
+  lexcounter<long long,char> lc('a'),lc2; lc.inc(1LL<<40); lc.dec(7);
+  roundtrip(lc,lc2);
+
+  ccounter<int> cc("x"),cc2; cc.inc(10); cc.dec(3);
+  roundtrip(cc,cc2);
+
+  aworset<int> aw("x"),aw2,aw3("y");
+  for (int i=0; i < 100; i++) aw.add(i);
+  for (int i=0; i < 100; i+=3) aw.rmv(i);
+  aw3.add(7); aw.join(aw3);
+  roundtrip(aw,aw2);
+  assert (aw2.read() == aw.read() && aw2.in(7));
+
+  aworset<int,string,flatstore> af("x"),af2;
+  af.add(1); af.add(2); af.rmv(1);
+  roundtrip(af,af2);
+
+  // A decoded delta joins like the original
+  aworset<int> d=aw.add(1000),dd,j1,j2;
+  roundtrip(d,dd);
+  j1=aw3; j2=aw3;
+  j1.join(d); j2.join(dd);
+  assert (printed(j1) == printed(j2));
+  cout << serialize(d).size() << " bytes for " << d << endl;
+
+  rworset<char> rw("x"),rw2; rw.add('a'); rw.add('b'); rw.rmv('a');
+  roundtrip(rw,rw2);
+
+  mvreg<pair<int,int> > mv("x"),mv2; 
+  mv.write(pair<int,int>(1,2)); mv.join(mvreg<pair<int,int> >("y"));
+  roundtrip(mv,mv2);
+
+  ewflag<> ew("x"),ew2; ew.enable();
+  roundtrip(ew,ew2);
+  dwflag<> dw("x"),dw2; dw.disable();
+  roundtrip(dw,dw2);
+
+  rwlwwset<int,string> rl,rl2; rl.add(1,"a"); rl.rmv(2,"b");
+  roundtrip(rl,rl2);
+
+  lwwreg<double,string> lw,lw2; lw.write(1.5,"a");
+  roundtrip(lw,lw2);
+
+  ormap<string,aworset<string>> om("x"),om2,om3;
+  om["color"].add("red"); om["color"].add("blue"); om["sound"].add("loud");
+  om.erase("sound");
+  roundtrip(om,om2);
+
+  ormap<int,ormap<string,aworset<string>>> nm("x"),nm2;
+  nm[2]["color"].add("red"); nm[3]["taste"].add("bitter");
+  roundtrip(nm,nm2);
+
+  bag<pair<int,int>> bg("i"),bg2; bg.mydata().first=3;
+  roundtrip(bg,bg2);
+
+  rwcounter<int> rc("i"),rc2; rc.inc(5); rc.dec();
+  roundtrip(rc,rc2);
+
+  gmap<string,gcounter<>> gm,gm2; gm["a"]=gcounter<>("x"); gm["a"].inc(3);
+  roundtrip(gm,gm2);
+
+  bcounter<int,char> bc('a'),bc2; bc.inc(10); bc.mv(3,'b');
+  roundtrip(bc,bc2);
+
+  orseq<> sq("s"),sq2; sq.push_back('a'); sq.push_back('b'); 
+  sq.push_front('c');
+  roundtrip(sq,sq2);
+
+  // Replica ids are only written once per message
+  ormap<string,aworset<string>> big("a-rather-long-replica-id");
+  for (int i=0; i < 10; i++) big[to_string(i)].add("v");
+  string b=serialize(big);
+  assert (b.find("a-rather-long-replica-id") == b.rfind("a-rather-long-replica-id"));
+
+  // Runs of dots are bounded, and kept compact where they can be
+  auto runs=[](int gap, unsigned long long len, int gap2) -> string
+  {
+    wireout w; w.byte(wiremagic); w.byte(wireversion);
+    w.uvarint(0); // no compact entries
+    w.uvarint(1); w.id(string("x")); w.uvarint(gap2 ? 2 : 1);
+    w.svarint(gap); w.uvarint(len);
+    if (gap2) { w.svarint(gap2); w.uvarint(0); }
+    w.uvarint(0); // no dots in the store
+    return w.bytes();
+  };
+  aworset<int> hostile;
+  assert (! deserialize(runs(5,5000000,0),hostile)); // too many cloud dots
+  assert (! deserialize(runs(5,1ULL<<31,0),hostile)); // past the largest int
+  assert (! deserialize(runs(numeric_limits<int>::max(),0,1),hostile));
+  assert (deserialize(runs(1,5000000,0),hostile)); // all compact
+  assert (hostile.context().cc.at("x") == 5000001 && hostile.context().dc.empty());
+  assert (deserialize(runs(numeric_limits<int>::max(),0,0),hostile));
+
+  // Dots of a store must increase, or the value index would disagree
+  auto store=[](vector<pair<string,int>> dots) -> string
+  {
+    wireout w; w.byte(wiremagic); w.byte(wireversion);
+    w.uvarint(0); w.uvarint(0); // empty context
+    w.uvarint(dots.size());
+    for (auto & d : dots)
+    {
+      w.id(d.first); w.uvarint(1);
+      ::encode(w,d.second); ::encode(w,d.second); // dot and value
+    }
+    return w.bytes();
+  };
+  assert (deserialize(store({{"a",1},{"b",1}}),hostile) && hostile.in(1));
+  assert (! deserialize(store({{"a",1},{"a",1}}),hostile));
+  assert (! deserialize(store({{"a",2},{"a",1}}),hostile));
+  assert (! deserialize(store({{"b",1},{"a",1}}),hostile));
+  wireout same; same.byte(wiremagic); same.byte(wireversion);
+  same.uvarint(0); same.uvarint(0); same.uvarint(1); same.id(string("a")); 
+  same.uvarint(2); ::encode(same,1); ::encode(same,1); 
+  ::encode(same,0); ::encode(same,2); // a:1 again, with another value
+  assert (! deserialize(same.bytes(),hostile));
+
+  // Sequence entries must increase by position and id
+  auto seq=[](vector<pair<vector<bool>,string>> es) -> string
+  {
+    wireout w; w.byte(wiremagic); w.byte(wireversion);
+    w.uvarint(0); w.uvarint(0); // empty context
+    w.uvarint(es.size());
+    for (auto & e : es)
+    {
+      ::encode(w,e.first); w.id(e.second); ::encode(w,1); ::encode(w,'v');
+    }
+    return w.bytes();
+  };
+  vector<bool> p0={false,true}, p1={true,false};
+  orseq<> hseq;
+  assert (deserialize(seq({{p0,"a"},{p0,"b"},{p1,"a"}}),hseq));
+  assert (! deserialize(seq({{p0,"a"},{p0,"a"}}),hseq));
+  assert (! deserialize(seq({{p1,"a"},{p0,"a"}}),hseq));
+  assert (! deserialize(seq({{p0,"b"},{p0,"a"}}),hseq));
+
+  // Unknown versions are rejected
+  b[1]=wireversion+1;
+  assert (! deserialize(b,om3));
+  cout << om2 << endl;
+}
+
+template<typename T> // Joining the bytes is the same as decoding and joining
+void joinsame(const T & into, const T & o)
+{
+  T a,b,d; a=into; b=into;
+  string m=serialize(o);
+  assert (deserialize(m,d));
+  a.join(d);
+  assert (joinbytes(b,m));
+  assert (printed(a) == printed(b));
+  for (size_t i=0; i < m.size(); i++) // truncated: rejected, b untouched
+    assert (! joinbytes(b,m.substr(0,i)));
+  assert (printed(a) == printed(b));
+}
+
+void test_views()
+{
+  cout << "--- Testing: joins of encoded deltas --\n";
+  aworset<int> x("x"),y("y"),s;
+  for (int i=0; i < 20; i++) x.add(i);
+  y.join(x);
+  for (int i=0; i < 20; i+=2) y.rmv(i); // y has a dot cloud
+  x.add(100); y.add(100);
+  joinsame(x,y); joinsame(y,x); joinsame(s,x);
+  joinsame(x,y.add(5)); joinsame(x,y.rmv(3)); joinsame(y,x.reset());
+  assert (joinbytes(s,serialize(y)) && s.read() == y.read());
+  assert (! s.in(4) && s.in(5));
+  cout << s << endl;
+
+  aworset<int,string,flatstore> fx("x"),fy("y");
+  fx.add(1); fx.add(2); fy.join(fx); fy.rmv(1); fx.add(3);
+  joinsame(fx,fy); joinsame(fy,fx);
+
+  rworset<char> rx("x"),ry("y"); 
+  rx.add('a'); ry.join(rx); ry.rmv('a'); rx.add('b');
+  joinsame(rx,ry); joinsame(ry,rx);
+
+  mvreg<int> mx("x"),my("y"); mx.write(1); my.write(2);
+  joinsame(mx,my); joinsame(mx,my.write(3));
+
+  ccounter<int> cx("x"),cy("y"); cx.inc(5); cy.inc(2); cy.join(cx);
+  joinsame(cx,cy.dec(4));
+
+  ewflag<> ex("x"),ey("y"); ex.enable(); ey.join(ex); ey.disable();
+  joinsame(ex,ey);
+  dwflag<> dx("x"),dy("y"); dx.disable(); dy.join(dx); dy.enable();
+  joinsame(dx,dy);
+
+  bag<pair<int,int>> bx("i"),by; bx.mydata().first=3; by=bx; 
+  bx.mydata().second=4; // same dot, payloads join deep
+  joinsame(by,bx);
+
+  // Bytes of some other datatype are not taken as a delta
+  assert (! joinbytes(s,serialize(gset<int>())));
+  string m=serialize(x); m[1]++; // other format version
+  assert (! joinbytes(s,m));
+
+  // Runs join as ranges, up to the largest dot, and clouds are bounded
+  auto run=[](int first, unsigned long long len) -> string
+  {
+    wireout w; w.byte(wiremagic); w.byte(wireversion);
+    w.uvarint(1); w.id(string("y")); w.svarint(1); // left uncompacted
+    w.uvarint(1); w.id(string("y")); w.uvarint(1);
+    w.svarint(first); w.uvarint(len);
+    w.uvarint(0); // no dots in the store
+    return w.bytes();
+  };
+  s.context().insertdot(pair<string,int>("y",1));
+  assert (joinbytes(s,run(numeric_limits<int>::max(),0)));
+  assert (s.context().dotin(pair<string,int>("y",numeric_limits<int>::max())));
+  assert (joinbytes(s,run(2,5000000))); // continues the compact entry
+  assert (s.context().cc.at("y") == 5000002);
+  assert (! joinbytes(s,run(6000000,5000000))); // would be a cloud
+  assert (! s.context().dotin(pair<string,int>("y",6000000)));
+
+  // Ids and runs must increase, decoded or viewed
+  auto ctx=[](vector<string> ids, vector<pair<int,int>> runs) -> string
+  {
+    wireout w; w.byte(wiremagic); w.byte(wireversion);
+    w.uvarint(ids.size());
+    for (auto & i : ids) { w.id(i); w.svarint(1); }
+    w.uvarint(1); w.id(string("a")); w.uvarint(runs.size());
+    for (auto & r : runs) { w.svarint(r.first); w.uvarint(r.second); }
+    w.uvarint(0); // no dots in the store
+    return w.bytes();
+  };
+  aworset<int> u("u"),v;
+  for (int i=0; i < 5; i++) u.add(i);
+  for (string m : {ctx({"a","b"},{{3,0},{2,1}}),ctx({},{{5,0},{-2,0}}),
+    ctx({},{{5,0},{0,0}}),ctx({"b","a"},{{3,0}})})
+  {
+    bool ok= m == ctx({"a","b"},{{3,0},{2,1}});
+    assert (deserialize(m,v) == ok && joinbytes(u,m) == ok);
+  }
+  assert (u.read().size() == 5);
+}
+
+template<typename T, typename K> // Gossip until no replica has news
+void quiesce(loopback<T,K> & net)
+{
+  for (net.gossip(); net.pending() > 0; net.gossip()) net.run();
+}
+
+void test_replicator()
+{
+  cout << "--- Testing: delta-interval anti-entropy --\n";
+  typedef aworset<int> S;
+  replicator<S> a("a"),b("b"),c("c");
+  loopback<S> net;
+  net.attach(a); net.attach(b); net.attach(c);
+  net.link("a","b"); net.link("b","c"); // c only hears from a via b
+
+  a.operate([](S & s){ return s.add(1); });
+  a.operate([](S & s){ return s.add(2); });
+  c.operate([](S & s){ return s.add(3); });
+  assert (a.buffered() == 2);
+  quiesce(net);
+  assert (printed(a.state()) == printed(b.state()));
+  assert (printed(b.state()) == printed(c.state()));
+  S cs; cs=c.state();
+  assert (cs.read() == set<int>({1,2,3}));
+  // All acknowledged, buffers were collected
+  assert (a.buffered() == 0 && b.buffered() == 0 && c.buffered() == 0);
+
+  // Lost, duplicated and reordered messages are shipped again 
+  b.operate([](S & s){ return s.rmv(1); });
+  a.operate([](S & s){ return s.add(4); });
+  net.gossip();
+  net.lose(); net.duplicate(); net.reorder();
+  while (net.pending() > 0) { net.step(); net.duplicate(); net.lose(); }
+  quiesce(net);
+  cs=c.state();
+  assert (cs.read() == set<int>({2,3,4}));
+  assert (printed(a.state()) == printed(c.state()));
+
+  // A new peer is sent the full state, its deltas were already collected
+  replicator<S> e("e");
+  net.attach(e); net.link("c","e");
+  size_t before=net.bytes;
+  quiesce(net);
+  assert (printed(e.state()) == printed(a.state()));
+  cout << "full state to new peer: " << net.bytes-before << " bytes" << endl;
+
+  // Malformed messages are ignored
+  assert (a.receive("b","junk") == "" && a.receive("b",serialize(S())) == "");
+
+  // Duplicates are not buffered again, removals that add no dots are
+  replicator<S> p("p"),q("q");
+  p.addpeer("q"); q.addpeer("p");
+  p.operate([](S & s){ return s.add(7); });
+  string m=p.ship("q");
+  q.receive("p",m); q.receive("p",m);
+  assert (q.buffered() == 1);
+  p.operate([](S & s){ return s.rmv(7); });
+  q.receive("p",p.ship("q"));
+  assert (q.buffered() == 2 && ! q.state().in(7));
+
+  // Any datatype, here without a causal context
+  replicator<gcounter<>> g1("x"),g2("y");
+  loopback<gcounter<>> gnet;
+  gnet.attach(g1); gnet.attach(g2); gnet.link("x","y");
+  g1.operate([](gcounter<> & s){ return s.inc(2); });
+  g2.operate([](gcounter<> & s){ return s.inc(3); });
+  quiesce(gnet);
+  assert (g1.state().read() == 5 && g2.state().read() == 5);
+
+  // And maps, which start with no id 
+  typedef ormap<string,aworset<string>> M;
+  replicator<M> m1("x"),m2("y");
+  loopback<M> mnet;
+  mnet.attach(m1); mnet.attach(m2); mnet.link("x","y");
+  m1.operate([](M & s){ M r; r["fruit"].join(s["fruit"].add("kiwi")); return r; });
+  quiesce(mnet);
+  cout << m2.state() << endl;
+}
+
+void test_deltabatch()
+{
+  cout << "--- Testing: delta batches --\n";
+  aworset<int> x("x"),d;
+  deltabatch<aworset<int>> b;
+  for (int i=0; i < 100; i++) 
+  {
+    aworset<int> o=x.add(i%30); // re-adds remove older dots
+    d.join(o); b.add(o);
+  }
+  aworset<int> r; 
+  r=x.rmv(3); b.add(r); d.join(r);
+  assert (b.size() == 101);
+  aworset<int> bd=b.close();
+  assert (printed(bd) == printed(d) && b.empty());
+  assert (bd.context().dc.empty()); // compacted on close
+  aworset<int> y("y"),z("z"); 
+  y.join(bd); z.join(x);
+  assert (printed(y.read()) == printed(z.read()));
+
+  deltabatch<gcounter<>> gb;
+  gcounter<> g("a");
+  for (int i=0; i < 7; i++) gb.add(g.inc());
+  assert (gb.close().read() == 7 && gb.close().read() == 0);
+
+  typedef ormap<string,aworset<string>> M;
+  M m("x"),md;
+  deltabatch<M> mb;
+  for (const string k : {"a","b","a","c"})
+  {
+    M o; 
+    o[k].join(m[k].add(k+"1"));
+    md.join(o); mb.add(o);
+  }
+  M e;
+  e=m.erase("b"); mb.add(e); md.join(e);
+  assert (printed(mb.close()) == printed(md));
+}
+
+void test_moves()
+{
+  cout << "--- Testing: copies and joins of temporaries --\n";
+  aworset<int> a("a"); a.add(1);
+  aworset<int> b=a; // copies get their own context
+  b.add(2);
+  assert (a.read() == set<int>({1}) && b.read() == set<int>({1,2}));
+  assert (printed(a.context()) != printed(b.context()));
+
+  aworset<int> x("x"),j1,j2,e;
+  x.add(3);
+  aworset<int> d=x.add(4), d2=d;
+  j1.join(d); j2.join(std::move(d2)); e.join(x.rmv(4));
+  assert (printed(j1) == printed(j2)); // taken over
+  j1.join(e); j2.join(std::move(e)); // joined as usual
+  assert (printed(j1) == printed(j2));
+
+  aworset<int> m; m=join(x.add(6),a);
+  assert (m.read() == set<int>({1,6}));
+  assert (printed(join(aworset<int>(),a)) == printed(join(a,aworset<int>())));
+  aworset<int> n=join(aworset<int>(a),x); // keeps the id of the left side
+  assert (n.add(7).context().dotin(pair<string,int>("a",2)));
+  gcounter<> g("g"),h("h"); h.inc();
+  gcounter<> gh=join(gcounter<>(g),h); gh.inc();
+  assert (gh.local() == 1 && gh.read() == 2);
+
+  bag<int> bg("i"),bj; bg.mydata()=5;
+  bj.join(bag<int>(bg));
+  assert (printed(bj) == printed(bg));
+}
+
+void test_allocators()
+{
+  cout << "--- Testing: arena and pool allocators --\n";
+  arena ar(1024);
+  void * p1=ar.allocate(3,1);
+  void * p2=ar.allocate(8,8);
+  assert (reinterpret_cast<uintptr_t>(p2) % 8 == 0 && p2 > p1);
+  ar.allocate(5000,16); // larger than a block
+  size_t r=ar.reserved();
+  ar.reset();
+  ar.allocate(3,1); ar.allocate(5000,16);
+  assert (ar.reserved() == r); // blocks were reused
+
+  // Replicas made outside the arena stay on the heap, deltas use it
+  typedef aworset<int,string,arenastore> S;
+  S x("x"),y("y"),z("z");
+  typedef ormap<string,S> M;
+  M m("m"),n("n");
+  for (int round=0; round < 3; round++)
+  {
+    {
+      arena::scope sc(ar);
+      for (int i=0; i < 50; i++) 
+      {
+        y.join(x.add(i*round));
+        M d; // new keys are made inside the arena
+        d[to_string(i%7+round)].join(m[to_string(i%7+round)].add(i)); 
+        n.join(d);
+      }
+      y.join(x.rmv(3)); 
+    }
+    ar.reset(); 
+    z.join(x); // x and y were not in the arena 
+  }
+  assert (printed(y) == printed(z) && printed(m) == printed(n));
+  assert (y.read() == x.read() && ! y.in(3));
+  cout << y.read().size() << " elements, " << ar.reserved() 
+    << " arena bytes" << endl;
+
+  aworset<int,string,poolstore> px("x"),py("y");
+  aworset<int> dx("x"),dy("y");
+  for (int i=0; i < 100; i++) 
+  {
+    py.join(px.add(i%13)); dy.join(dx.add(i%13));
+    if (i%5 == 0) { py.join(px.rmv(i%7)); dy.join(dx.rmv(i%7)); }
+  }
+  assert (printed(py) == printed(dy));
+
+  // Datatypes without a kernel take an allocator directly
+  gset<int,poolallocator> gs; gs.add(1); gs.add(2);
+  twopset<int,string,poolallocator> tp; tp.add(1); tp.rmv(1); tp.add(2);
+  gcounter<int,string,poolallocator> gc("a"); gc.inc(2);
+  pncounter<int,string,arenaallocator> pn("a"); pn.inc(5); pn.dec(2);
+  bcounter<int,string,poolallocator> bc("a"); bc.inc(10);
+  orseq<char,string,poolallocator> sq("s"); 
+  sq.push_back('a'); sq.push_back('b');
+  assert (gs.read().size() == 2 && tp.read().size() == 1);
+  assert (gc.read() == 2 && pn.read() == 3 && bc.local() == 10);
+  assert (get<2>(*sq.begin()) == 'a' && distance(sq.begin(),sq.end()) == 2);
+  gset<int,poolallocator> gs2;
+  roundtrip(gs,gs2);
+}
+
+void test_replicaid()
+{
+  cout << "--- Testing: interned replica ids --\n";
+  replicaid a("alice"),b(string("bob")),a2("alice"),none;
+  assert (a == a2 && a != b && a.name() == "alice" && none.name() == "");
+  assert (sizeof(pair<replicaid,int>) == 2*sizeof(int));
+
+  aworset<int,replicaid> x("x"),y("y"),x2;
+  aworset<int> sx("x"),sy("y");
+  for (int i=0; i < 20; i++) 
+  {
+    y.join(x.add(i)); sy.join(sx.add(i));
+    if (i%3 == 0) { x.join(y.rmv(i/2)); sx.join(sy.rmv(i/2)); }
+  }
+  assert (x.read() == sx.read() && y.read() == sy.read());
+  assert (printed(x) == printed(sx)); // printed by name
+  roundtrip(x,x2);
+  assert (printed(x2) == printed(x));
+
+  // Numbers are local, messages carry names, and ids are ordered by them
+  aworset<int,replicaid> z("z");
+  assert (joinbytes(z,serialize(x.add(100))) && z.in(100));
+  replicaid late("order-b"),early("order-a"); // interned out of order
+  assert (early < late && ! (late < early) && late > early && early <= early);
+  orseq<char,replicaid> qb("order-b"),qa("order-a"),q1,q2;
+  orseq<char> sb("order-b"),sa("order-a"),s1;
+  string db=serialize(qb.push_back('B')), da=serialize(qa.push_back('A'));
+  sb.push_back('B'); sa.push_back('A');
+  orseq<char,replicaid> d; 
+  assert (deserialize(db,d)); q1.join(d); 
+  assert (deserialize(da,d)); q1.join(d);
+  assert (deserialize(da,d)); q2.join(d);
+  assert (deserialize(db,d)); q2.join(d);
+  s1.join(sb); s1.join(sa);
+  string r1,r2,rs;
+  for (auto & e : q1) r1+=get<2>(e);
+  for (auto & e : q2) r2+=get<2>(e);
+  for (auto & e : s1) rs+=get<2>(e);
+  assert (r1 == r2 && r1 == rs); // as with string ids, in any process
+
+  ormap<string,mvreg<string,replicaid>,replicaid> m("m"),m2;
+  m["k"].write("v");
+  roundtrip(m,m2);
+  cout << m2;
+}
+
+void test_cachedtotals()
+{
+  cout << "--- Testing: cached counter totals --\n";
+  vector<gcounter<int> > g={gcounter<int>("a"),gcounter<int>("b"),gcounter<int>("c")};
+  vector<pncounter<int> > p={pncounter<int>("a"),pncounter<int>("b"),pncounter<int>("c")};
+  vector<lexcounter<int> > l={lexcounter<int>("a"),lexcounter<int>("b"),lexcounter<int>("c")};
+  gcounter<int> gd; pncounter<int> pd; lexcounter<int> ld; // delta groups
+  srand(11);
+  for (int i=0; i < 2000; i++)
+  {
+    int r=rand()%3, o=rand()%3, v=rand()%10;
+    switch (rand()%4)
+    {
+      case 0: gd.join(g[r].inc(v)); pd.join(p[r].inc(v)); ld.join(l[r].inc(v)); break;
+      case 1: pd.join(p[r].dec(v)); ld.join(l[r].dec(v)); break;
+      case 2: g[r].join(g[o]); p[r].join(p[o]); l[r].join(l[o]); break;
+      case 3: g[r].join(gd); p[r].join(pd); l[r].join(ld); break;
+    }
+    assert (g[r].read() == g[r].fold() && gd.read() == gd.fold());
+    assert (p[r].read() == p[r].fold() && pd.read() == pd.fold());
+    assert (l[r].read() == l[r].fold() && ld.read() == ld.fold());
+  }
+  gcounter<int> g2; pncounter<int> p2; lexcounter<int> l2;
+  roundtrip(g[0],g2); roundtrip(p[0],p2); roundtrip(l[0],l2);
+  assert (g2.read() == g[0].read() && p2.read() == p[0].read() && l2.read() == l[0].read());
+  for (int r=1; r < 3; r++) { g[0].join(g[r]); p[0].join(p[r]); l[0].join(l[r]); }
+  assert (g[0].read() == gd.read() && p[0].read() == pd.read() && l[0].read() == ld.read());
+  cout << g[0].read() << " " << p[0].read() << " " << l[0].read() << endl;
+
+  // Floating point counters read the fold, whatever order deltas come in
+  gcounter<float> fa("a"),fb("b"); lexcounter<float> la("a"),lb("b");
+  fa.inc(1e6f); la.inc(1e6f);
+  for (int i=0; i < 1000; i++) { fa.join(fb.inc(0.1f)); la.join(lb.inc(0.1f)); }
+  pncounter<float,int> pf(1),pg(2); pf.inc(1e6f);
+  for (int i=0; i < 1000; i++) pf.join(pg.dec(0.1f));
+  assert (fa.read() == fa.fold() && la.read() == la.fold());
+  assert (pf.read() == pf.fold());
+}
+
+void test_densecounters()
+{
+  cout << "--- Testing: fixed membership counters --\n";
+  membership<string> ms({"a","b","c"});
+  vector<densepncounter<int> > d;
+  vector<pncounter<int> > p;
+  for (int r=0; r < 3; r++) 
+  { 
+    d.push_back(densepncounter<int>(ms,ms.id(r))); 
+    p.push_back(pncounter<int>(ms.id(r))); 
+  }
+  densepncounter<int> dd; pncounter<int> pd; // delta groups
+  srand(12);
+  for (int i=0; i < 1000; i++)
+  {
+    int r=rand()%3, o=rand()%3, v=rand()%10;
+    switch (rand()%4)
+    {
+      case 0: dd.join(d[r].inc(v)); pd.join(p[r].inc(v)); break;
+      case 1: dd.join(d[r].dec(v)); pd.join(p[r].dec(v)); break;
+      case 2: d[r].join(d[o]); p[r].join(p[o]); break;
+      case 3: d[r].join(dd); p[r].join(pd); break;
+    }
+    assert (d[r].read() == p[r].read() && d[r].read() == d[r].fold());
+    assert (dd.read() == pd.read() && dd.read() == dd.fold());
+  }
+  densepncounter<int> d2(ms,"b"); // decoding needs the membership to print ids
+  roundtrip(d[0],d2);
+  assert (d2.read() == d[0].read());
+  for (int r=1; r < 3; r++) d[0].join(d[r]);
+  assert (d[0] == dd && d[0].read() == pd.read());
+
+  densegcounter<int> x(ms,"a"),y(ms,"c"),z;
+  x.inc(); 
+  z.join(y.inc(2)); // a delta only holds entries up to c
+  x.join(z);
+  assert (x.read() == 3);
+  cout << x << endl;
+
+  // Entries past the membership are rejected, and so are unknown ids
+  membership<string> five({"a","b","c","d","e"});
+  densegcounter<int> big(five,"e"),w(ms,"b");
+  big.inc();
+  assert (! deserialize(serialize(big),w));
+  assert (deserialize(serialize(z),w) && w.read() == 2 && w.inc().read() == 1);
+  bool thrown=false;
+  try { densegcounter<int> u(ms,"u"); } catch (out_of_range &) { thrown=true; }
+  assert (thrown);
+}
+
+void test_counterbanks()
+{
+  cout << "--- Testing: counter banks --\n";
+  membership<string> ms({"a","b","c"});
+  const size_t n=21; // not a multiple of the SIMD width
+  vector<pncounterbank<int> > b;
+  vector<vector<pncounter<int> > > p(3);
+  for (int r=0; r < 3; r++) 
+  {
+    b.push_back(pncounterbank<int>(ms,ms.id(r),n));
+    for (size_t i=0; i < n; i++) p[r].push_back(pncounter<int>(ms.id(r)));
+  }
+  srand(13);
+  for (int k=0; k < 2000; k++)
+  {
+    int r=rand()%3, o=rand()%3, v=rand()%10;
+    size_t i=rand()%n;
+    switch (rand()%3)
+    {
+      case 0: b[r].inc(i,v); p[r][i].inc(v); break;
+      case 1: b[r].dec(i,v); p[r][i].dec(v); break;
+      case 2: 
+        b[r].join(b[o]); 
+        for (size_t j=0; j < n; j++) p[r][j].join(p[o][j]); 
+        break;
+    }
+    for (size_t j=0; j < n; j++) 
+      assert (b[r].read(j) == p[r][j].read() && b[r].read(j) == b[r].fold(j));
+  }
+  pncounterbank<int> b2(ms,"b",n);
+  roundtrip(b[0],b2);
+  assert (b2 == b[0]);
+  pncounterbank<int> small(ms,"b",n-1);
+  assert (!deserialize(serialize(b[0]),small)); // shapes must agree
+  gcounterbank<long> l(ms,"a",3),l2(ms,"c",3);
+  l.inc(2,5); l2.inc(2,7); l2.inc(0); l.join(l2);
+  assert (l.read(2) == 12 && l.read(0) == 1);
+  gcounterbank<long> none;
+  l.join(none); none.join(l); // banks without a membership
+  assert (none == l && none.read(2) == 12);
+  cout << l << endl;
+}
+
+void test_ccounter()
+{
+  cout << "--- Testing: ccounter own dot --\n";
+  ccounter<int> x("x"),y("y"),d;
+  y.join(x.inc(2));
+  x.join(y.inc(5));
+  d=x.dec(3); // below zero on x
+  assert (printed(d) == "CausalCounter:Kernel: DS ( x:2->-1 ) Context: CC ( x:2 ) DC ( )");
+  y.join(d);
+  y.join(x.dec());
+  assert (x.read() == 3 && y.read() == 3);
+  x.join(y.reset()); // x's dot removed elsewhere
+  assert (x.read() == 0);
+  y.join(x.inc(4));
+  assert (x.read() == 4 && y.read() == 4);
+  ccounter<int> x2("x");
+  roundtrip(x,x2); // x2 finds the dot of x by id
+  x2.inc(); 
+  assert (x2.read() == 5);
+  cout << x2 << endl;
+}
+
+void test_bcounter()
+{
+  cout << "--- Testing: bcounter flows --\n";
+  vector<bcounter<int> > rs;
+  for (int i=0; i < 4; i++) { rs.push_back(bcounter<int>(to_string(i))); rs[i].inc(100); }
+  bcounter<int> d; // all deltas
+  srand(16);
+  for (int k=0; k < 500; k++)
+  {
+    int i=rand()%4, j=rand()%4, q=rand()%4;
+    switch (rand()%3)
+    {
+      case 0: d.join(rs[i].mv(q,to_string(j))); break;
+      case 1: d.join(rs[i].dec(q)); break;
+      case 2: rs[i].join(rs[j]); if (q == 0) rs[i].join(d); break;
+    }
+    assert (rs[i].local() >= 0);
+  }
+  bcounter<int> x2("2"); 
+  roundtrip(rs[2],x2); // flows recomputed on decode
+  assert (x2.local() == rs[2].local());
+  int sum=0;
+  for (int i=0; i < 4; i++) { rs[i].join(d); sum+=rs[i].local(); }
+  assert (sum == rs[0].read());
+  cout << rs[0].read() << endl;
+}
+
+void test_bagown()
+{
+  cout << "--- Testing: bag own entry --\n";
+  rwcounter<int> x("x"),y("y");
+  y.join(x.inc(3));
+  x.join(y.inc(2));
+  x.inc(); x.dec(2);
+  assert (x.read() == 4);
+  y.join(x);
+  x.join(y.reset()); // removes the entry x was using
+  assert (x.read() == 0);
+  rwcounter<int> d=x.inc(5); // on a fresh dot
+  assert (x.read() == 5);
+  y.join(d);
+  assert (y.read() == 5);
+  rwcounter<int> x2("x");
+  roundtrip(x,x2);
+  x2.inc();
+  assert (x2.read() == 6);
+  bag<int> b("b");
+  pair<string,int> dot=b.mydot();
+  b.mydata()+=2;
+  assert (b.mydot() == dot && b.mydata() == 2);
+  b.reset();
+  assert (b.mydot() != dot && b.mydata() == 0);
+  cout << x2 << endl;
+}
+
+void test_hashsets()
+{
+  cout << "--- Testing: hash element sets --\n";
+  hashset<int> h;
+  for (int i=0; i < 1000; i++) h.insert(i);
+  for (int i=0; i < 1000; i+=2) assert (h.erase(i) == 1);
+  for (int i=0; i < 1000; i++) assert (h.count(i) == size_t(i%2)); // past tombstones
+  for (int i=0; i < 1000; i+=4) h.insert(i);
+  assert (h.size() == 750 && h.erase(1) == 1 && h.erase(1) == 0);
+
+  gset<int> a; gset<int,allocator,hashstore> ha;
+  twopset<string> b,c; twopset<string,string,allocator,hashstore> hb,hc;
+  srand(17);
+  for (int i=0; i < 2000; i++)
+  {
+    int v=rand()%500;
+    switch (rand()%4)
+    {
+      case 0: a.add(v); ha.add(v); break;
+      case 1: b.add(to_string(v)); hb.add(to_string(v)); break;
+      case 2: b.join(c.rmv(to_string(v))); hb.join(hc.rmv(to_string(v))); break;
+      case 3: c.join(b.add(to_string(v))); hc.join(hb.add(to_string(v))); break;
+    }
+  }
+  c.join(b); hc.join(hb);
+  assert (printed(ha) == printed(a)); // printed in order
+  assert (printed(hb) == printed(b) && printed(hc) == printed(c));
+  assert (serialize(hc) == serialize(c)); // and encoded in order
+  twopset<string,string,allocator,hashstore> hc2;
+  roundtrip(hc,hc2);
+  assert (hc2 == hc && hc2.in("7") == c.in("7"));
+  gset<int,allocator,hashstore> hj;
+  hj.join(ha); hj.join(ha);
+  assert (hj == ha);
+  cout << hj.read().size() << " " << hc.read().size() << endl;
+}
+
+void test_bloomtombs()
+{
+  cout << "--- Testing: bloom filtered tombstones --\n";
+  bloomset<int> f;
+  for (int i=0; i < 5000; i+=2) assert (f.insert(i));
+  assert (! f.insert(10) && f.size() == 2500);
+  size_t hits=0;
+  for (int i=0; i < 5000; i++) hits+=f.count(i);
+  assert (hits == 2500 && f.count(4) == 1 && f.count(5) == 0);
+
+  twopset<int> a,b; 
+  twopset<int,string,allocator,bloomstore<> > fa,fb;
+  twopset<int,string,allocator,bloomstore<hashstore> > ha;
+  srand(18);
+  for (int i=0; i < 3000; i++)
+  {
+    int v=rand()%400;
+    switch (rand()%4)
+    {
+      case 0: b.join(a.add(v)); fb.join(fa.add(v)); ha.add(v); break;
+      case 1: a.join(b.rmv(v)); fa.join(fb.rmv(v)); ha.rmv(v); break;
+      case 2: b.join(a.rmv(v)); fb.join(fa.rmv(v)); break;
+      case 3: a.join(b); fa.join(fb); break;
+    }
+  }
+  a.join(b); fa.join(fb);
+  assert (printed(fa) == printed(a) && serialize(fa) == serialize(a));
+  twopset<int,string,allocator,bloomstore<> > fa2;
+  roundtrip(fa,fa2);
+  assert (fa2 == fa);
+  for (int v=0; v < 400; v++) assert (fa2.in(v) == a.in(v));
+  cout << fa.read().size() << " " << ha.read().size() << endl;
+}
+
+void test_rworsetindex()
+{
+  cout << "--- Testing: rworset reads from the value index --\n";
+  rworset<int> x("x"),y("y"),z("z");
+  map<int,bool> last; // sequential ops: the last one decides
+  srand(19);
+  for (int i=0; i < 1000; i++)
+  {
+    int v=rand()%50;
+    bool a=rand()%3 > 0;
+    if (rand()%2) y.join(a ? x.add(v) : x.rmv(v)); 
+    else x.join(a ? y.add(v) : y.rmv(v));
+    last[v]=a;
+  }
+  set<int> model;
+  for (const auto & kv : last) if (kv.second) model.insert(kv.first);
+  assert (x.read() == model && y.read() == model);
+  for (int v=0; v < 50; v++) assert (x.in(v) == (model.count(v) == 1));
+  // Concurrent ops, the removes win
+  z.join(x);
+  for (int v=0; v < 50; v++) { x.add(v); if (v%2) z.rmv(v); else z.add(v); }
+  x.join(z);
+  for (int v=0; v < 50; v++) assert (x.in(v) == (v%2 == 0));
+  const rworset<int> & cx=x;
+  assert (cx.read().size() == 25);
+  cout << cx.read().size() << endl;
+}
+
+void test_materialized()
+{
+  cout << "--- Testing: aworset and mvreg read views --\n";
+  aworset<int> x("x"),y("y"),d;
+  srand(20);
+  for (int i=0; i < 1000; i++)
+  {
+    int v=rand()%50;
+    switch (rand()%5)
+    {
+      case 0: y.join(x.rmv(v)); break;
+      case 1: d=join(y.add(v),d); break; // taken over by a temporary
+      case 2: if (i%97 == 0) x.join(y.reset()); break;
+      default: x.join(y.add(v)); y.join(x.add(v+50));
+    }
+    if (i%10 == 0) { x.join(d); d=aworset<int>(); }
+  }
+  aworset<int> back;
+  roundtrip(x,back); // decoding rebuilds the index from the dots
+  auto es=x.elements();
+  assert (set<int>(es.begin(),es.end()) == back.read());
+  assert (es.size() == x.read().size());
+  for (int v=0; v < 100; v++) assert (x.in(v) == (x.read().count(v) == 1));
+
+  mvreg<int> r("r"),s("s");
+  for (int i=0; i < 100; i++) 
+  {
+    if (i%3) s.join(r.write(i)); else r.join(s.write(i));
+    if (i%7 == 0) { r.write(-i); s.write(i); r.join(s); }
+  }
+  mvreg<int> rb;
+  roundtrip(r,rb);
+  const mvreg<int> & cr=r;
+  assert (cr.read() == rb.read() && cr.values().size() == rb.read().size());
+  for (const int & v : cr.values()) cout << v << " ";
+  cout << es.size() << endl;
+}
+
+struct plainset // An aworset that does not list its dots, see ormap::join
+{
+  aworset<int> s;
+  plainset() {}
+  plainset(string k, dotcontext<string> & c) : s(k,c) {}
+  dotcontext<string> & context() { return s.context(); }
+  plainset add(int v) { plainset r; r.s=s.add(v); return r; }
+  plainset rmv(int v) { plainset r; r.s=s.rmv(v); return r; }
+  plainset reset() { plainset r; r.s=s.reset(); return r; }
+  void join(const plainset & o) { s.join(o.s); }
+  friend ostream &operator<<(ostream &output, const plainset & o)
+  {
+    return output << o.s;
+  }
+};
+
+template<typename M> // Random ops and joins, with deltas and full states
+string ormapops(int seed)
+{
+  M a("a"),b("b");
+  srand(seed);
+  for (int i=0; i < 3000; i++)
+  {
+    string k=to_string(rand()%20);
+    int v=rand()%10;
+    switch (rand()%7)
+    {
+      case 0: { M d; d[k].join(a[k].add(v)); b.join(d); break; }
+      case 1: { M d; d[k].join(b[k].rmv(v)); a.join(d); break; }
+      case 2: { M d; d[k].join(a[k].reset()); b.join(d); break; }
+      case 3: b.join(a.erase(k)); break;
+      case 4: if (i%5 == 0) a.join(b); else b.join(a); break;
+      default: (rand()%2 ? a : b)[k].add(v); // only shipped with the state
+    }
+  }
+  string r=printed(a)+printed(b);
+  a.join(b); b.join(a);
+  return r+printed(a)+printed(b);
+}
+
+void test_ormapindex()
+{
+  cout << "--- Testing: ormap joins through the dot index --\n";
+  for (int seed=1; seed <= 5; seed++)
+  {
+    typedef ormap<string,aworset<int>> M; // joined through the index
+    typedef ormap<string,plainset> P; // joined by walking all keys
+    assert (ormapops<M>(seed) == ormapops<P>(seed));
+  }
+  ormap<string,ormap<string,aworset<int>>> x("x"),y("y"),d;
+  x["a"]["b"].add(1); y.join(x);
+  d["a"].join(x["a"].erase("b")); y.join(d);
+  x["a"]["c"].add(2); y.join(x);
+  assert (y["a"]["b"].read().empty() && y["a"]["c"].read() == set<int>({2}));
+  cout << y["a"]["c"] << endl;
+
+  // Writes through references kept across joins are indexed too
+  ormap<string,aworset<int>> m("m"),o("o");
+  m["k1"].add(1); o.join(m);
+  auto & v=m["k2"]; 
+  m.join(o); 
+  v.add(5); 
+  o.join(m); o.erase("k2"); m.join(o);
+  assert (m["k2"].read().empty() && printed(m["k2"]) == printed(o["k2"]));
+
+  // Applies index the dots they add, so removals of them are still seen
+  m.join(o);
+  auto da=m.apply("k3",[](aworset<int> & s) { return s.add(3); });
+  o.join(da); m.join(o.erase("k3"));
+  assert (m["k3"].read().empty());
+}
+
+struct flakyset : plainset // A set whose joins can be made to throw
+{
+  static bool fail;
+  flakyset() {}
+  flakyset(string k, dotcontext<string> & c) : plainset(k,c) {}
+  void join(const flakyset & o) 
+  { 
+    if (fail) throw runtime_error("join"); 
+    plainset::join(o); 
+  }
+};
+bool flakyset::fail=false;
+
+template<typename M> // As ormapops, for maps of maps
+string nestedops(int seed)
+{
+  M a("a"),b("b");
+  srand(seed);
+  for (int i=0; i < 3000; i++)
+  {
+    string k=to_string(rand()%5), l=to_string(rand()%5);
+    int v=rand()%10;
+    switch (rand()%6)
+    {
+      case 0: { M d; d[k][l].join(a[k][l].add(v)); b.join(d); break; }
+      case 1: { M d; d[k].join(b[k].erase(l)); a.join(d); break; }
+      case 2: b.join(a.erase(k)); break;
+      case 3: if (i%5 == 0) a.join(b); else b.join(a); break;
+      default: (rand()%2 ? a : b)[k][l].add(v);
+    }
+  }
+  assert (! a.context().held && ! b.context().held);
+  return printed(a)+printed(b);
+}
+
+void test_ormapcontext()
+{
+  cout << "--- Testing: ormap joins against a held context --\n";
+  typedef ormap<string,ormap<string,aworset<int>>> M;
+  typedef ormap<string,ormap<string,plainset>> P;
+  for (int seed=1; seed <= 5; seed++)
+    assert (nestedops<M>(seed) == nestedops<P>(seed));
+  M x("x"),y("y");
+  x["a"]["b"].add(1); y["a"]["b"].add(2);
+  x.join(y); y.join(x);
+  assert (printed(x["a"]) == printed(y["a"]));
+  cout << x.context() << endl;
+
+  // A value join that throws leaves the context as it was
+  ormap<string,flakyset> f("f"),g("g");
+  g["k"].s.add(1);
+  flakyset::fail=true;
+  try { f.join(g); } catch (runtime_error &) {}
+  flakyset::fail=false;
+  assert (! f.context().held);
+  f.join(g);
+  assert (f["k"].s.in(1) && f.context().dotin(pair<string,int>("g",1)));
+}
+
+void test_mapapply()
+{
+  cout << "--- Testing: map deltas from apply --\n";
+  typedef ormap<string,aworset<int>> M;
+  M x("x"),y("y");
+  size_t sent=0;
+  srand(23);
+  for (int i=0; i < 2000; i++)
+  {
+    string k=to_string(rand()%500);
+    int v=rand()%10;
+    M d= rand()%4 ? x.apply(k,[v](aworset<int> & s) { return s.add(v); }) :
+      x.apply(k,[v](aworset<int> & s) { return s.rmv(v); });
+    string msg=serialize(d);
+    sent+=msg.size();
+    M back;
+    assert (deserialize(msg,back));
+    y.join(back);
+  }
+  assert (printed(x) == printed(y));
+  assert (sent/2000 < serialize(x).size()/100);
+
+  typedef ormap<string,aworset<int>> I;
+  ormap<string,I> n("n"),o("o");
+  o.join(n.apply("a",[](I & m) 
+    { return m.apply("b",[](aworset<int> & s) { return s.add(1); }); }));
+  assert (o["a"]["b"].read() == set<int>({1}) && printed(n) == printed(o));
+
+  gmap<string,gcounter<>> g,h;
+  g["a"]=gcounter<>("x");
+  h.join(g.apply("a",[](gcounter<> & c) { return c.inc(2); }));
+  h.join(g.apply("a",[](gcounter<> & c) { return c.inc(3); }));
+  assert (h["a"].read() == 5);
+  cout << h;
+}
+
+void test_shardedormap()
+{
+  cout << "--- Testing: sharded ormap --\n";
+  typedef shardedormap<string,aworset<int>> S;
+  S x("x",8),y("y",8),z("z",8);
+  // Writers on x ship each delta to its shard of y, as they go
+  vector<thread> ts;
+  for (int t=0; t < 4; t++)
+    ts.push_back(thread([&x,&y,t]()
+    {
+      for (int i=0; i < 500; i++)
+      {
+        string k=to_string(i%50);
+        y.join(x.shardof(k),
+          x.apply(k,[t,i](aworset<int> & s) { return s.add(t*1000+i); }));
+        if (i%7 == 0) 
+          y.join(x.shardof(k),
+            x.apply(k,[t,i](aworset<int> & s) { return s.rmv(t*1000+i); }));
+      }
+    }));
+  for (auto & t : ts) t.join();
+  assert (printed(x) == printed(y));
+  size_t n=0;
+  for (int k=0; k < 50; k++) 
+    n+=x.at(to_string(k),[](aworset<int> & s) { return s.read().size(); });
+  assert (n == 4*(500-72));
+  z.join(y); y.join(x.shardof("0"),x.erase("0")); z.join(y);
+  assert (z.at("0",[](aworset<int> & s) { return s.read().empty(); }));
+  S back("b",8);
+  assert (deserialize(serialize(z),back) && printed(back) == printed(z));
+  S other("o",4);
+  assert (! deserialize(serialize(z),other)); // other shard count
+  assert (! z.join(8,x.erase("1"))); // no such shard
+  auto dk=x.apply("2",[](aworset<int> & s) { return s.add(-2); });
+  size_t sk=x.shardof("2");
+  assert (! z.join((sk+1)%z.shards(),dk)); // keys of another shard
+  assert (z.join(sk,dk) && z.at("2",[](aworset<int> & s) { return s.in(-2); }));
+  // Shards follow the key encoding, not the standard library
+  assert (wirehash<string>()("a") == 589763776587810007ULL); // bytes 1 'a'
+  cout << n << endl;
+}
+
+template<typename M> // Joins on threads match, for maps of values in store of M
+void storejoins(int seed)
+{
+  arena ar; // outlives the maps
+  arena::scope sc(ar); // used by arenastore
+  M m("m"),n("n");
+  srand(seed);
+  for (int i=0; i < 3000; i++)
+  {
+    string k=to_string(rand()%500);
+    if (rand()%2) m[k].add(rand()%10); else n[k].add(rand()%10);
+    if (i == 1500) n.join(m);
+  }
+  M p=m;
+  m.join(n); p.join(n,8);
+  assert (printed(m) == printed(p));
+}
+
+void test_paralleljoin()
+{
+  cout << "--- Testing: joins on threads --\n";
+  aworset<int> x("x"),y("y"),e;
+  srand(25);
+  for (int i=0; i < 5000; i++)
+  {
+    int v=rand()%2000;
+    if (rand()%3) x.add(v); else y.add(v);
+    if (i%10 == 0) y.join(x.rmv(rand()%2000));
+    if (i == 2500) x.join(y);
+  }
+  for (unsigned t : {1u,2u,3u,8u})
+  {
+    aworset<int> a=x,b=y,c=x,d=y,f=e;
+    a.join(y); b.join(x); f.join(x);
+    c.join(y,t); d.join(x,t); e.join(x,t);
+    assert (printed(a) == printed(c) && printed(b) == printed(d));
+    assert (printed(e) == printed(f) && a.read() == c.read());
+    e=aworset<int>();
+  }
+
+  typedef ormap<string,aworset<int>> M;
+  M m("m"),n("n");
+  for (int i=0; i < 3000; i++)
+  {
+    string k=to_string(rand()%500);
+    int v=rand()%10;
+    if (rand()%2) m[k].add(v); else n[k].add(v);
+    if (i%20 == 0) n.join(m.erase(to_string(rand()%500)));
+    if (i == 1500) n.join(m);
+  }
+  M p=m,q=m; // the values of copies use the context of the copy
+  string before=printed(m);
+  p.join(n); q.join(n,4);
+  assert (printed(p) == printed(q) && printed(m) == before);
+  ormap<string,M> o("o"),r("r");
+  for (int i=0; i < 1000; i++)
+  {
+    string k=to_string(rand()%5), l=to_string(rand()%100);
+    if (rand()%2) o[k][l].add(i); else r[k][l].add(i);
+    if (i == 500) r.join(o);
+  }
+  ormap<string,M> o2=o;
+  o.join(r); o2.join(r,3);
+  assert (printed(o) == printed(o2));
+  storejoins<ormap<string,aworset<int,string,arenastore>>>(26);
+  storejoins<ormap<string,aworset<int,string,poolstore>>>(27);
+
+  ormap<string,flakyset> f("f"),g("g"),h;
+  for (int i=0; i < 1000; i++) g[to_string(i)].s.add(i);
+  flakyset::fail=true;
+  bool thrown=false;
+  try { f.join(g,4); } catch (runtime_error &) { thrown=true; }
+  flakyset::fail=false;
+  assert (thrown && ! f.context().held);
+  f.join(g,4); h.join(g);
+  assert (printed(f) == printed(h));
+  cout << x.read().size() << " " << q.context() << endl;
+}
+
 void test_rworset()
 {
   cout << "--- Testing: rworset --\n";
@@ -572,36 +1898,957 @@ void benchmark1()
   */
 }
 
-void example_gset()
+void benchmark_compact()
 {
-  gset<string> a,b;
-
-  a.add("red");
-  b.add("blue");
+  using namespace std::chrono;
 
-  cout << join(a,b) << endl; // GSet: ( blue red )
+  cout << "--- Benchmark: dotcontext compaction under reordering --\n";
+  for (int n = 1000; n <= 1000000; n*=10)
+  {
+    // Deltas arrive in reverse order, so the cloud only collapses at the end
+    dotcontext<int> rev;
+    steady_clock::time_point t1 = steady_clock::now();
+    for (int i = n; i > 0; i--)
+    {
+      dotcontext<int> d;
+      d.insertdot(pair<int,int>(i%8,i));
+      rev.join(d);
+    }
+    steady_clock::time_point t2 = steady_clock::now();
+    // Interleaved halves, the odd dots only fill the gaps in the end
+    dotcontext<int> ilv;
+    for (int i = 2; i <= n; i+=2)
+      ilv.insertdot(pair<int,int>(0,i));
+    for (int i = 1; i <= n; i+=2)
+      ilv.insertdot(pair<int,int>(0,i));
+    steady_clock::time_point t3 = steady_clock::now();
+    assert (ilv.cc.at(0) == n && ilv.dc.empty());
+
+    duration<double> tj = duration_cast<duration<double>>(t2 - t1);
+    duration<double> ti = duration_cast<duration<double>>(t3 - t2);
+    cout << n << " dots: reversed joins " << tj.count() << "s (" 
+      << tj.count()*1e9/n << " ns/dot), interleaved inserts " << ti.count() 
+      << "s (" << ti.count()*1e9/n << " ns/dot)" << endl;
+  }
 }
 
-void example_twopset()
+template<typename S>
+void benchmark_dotstore(const char * name, int n)
 {
-  twopset<float> a,b;
-
-  a.add(3.1415);
-  a.rmv(3.1415);
-  b.add(42);
-  b.add(3.1415);
+  using namespace std::chrono;
 
-  cout << join(a,b) << endl; // 2PSet: S( 42 ) T ( 3.1415 )
+  // Two replicas with n dots each, half of them shared
+  // Dots are created id by id, so flat stores are built by appending
+  dotkernel<int,int,S> a,b;
+  for (int i=0; i < n; i++)
+  {
+    auto d=a.dotadd(i/(n/16),i);
+    if (i%2) b.ds.insert(b.ds.end(),
+      typename dotkernel<int,int,S>::dotstore::value_type(d,i));
+  }
+  for (int i=0; i < n/2; i++)
+    b.dotadd(16+i/(n/32),i);
+  b.c.join(a.c);
 
-  gset<float> c;
-  c.add(42);
+  size_t bytes=alloc_bytes;
+  typename dotkernel<int,int,S>::dotstore copy=a.ds;
+  bytes=alloc_bytes-bytes;
 
-  cout << ( join(a,b).read() == c.read() ) << endl; // true
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int r=0; r < 10; r++)
+  {
+    dotkernel<int,int,S> j;
+    j=a;
+    j.join(b);
+  }
+  steady_clock::time_point t2 = steady_clock::now();
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  cout << name << " " << n << " dots: " << double(bytes)/n << " bytes/dot, "
+    << "copy+join " << t.count()/10 << "s" << endl;
 }
 
-void example_pair()
+template<bool VI>
+void benchmark_valueindex(int n)
 {
-  pair<gset<int>,gset<char>> a,b,c;
+  using namespace std::chrono;
+
+  // Same pattern as benchmark1, add all, remove odds and add all again
+  dotkernel<int,char,mapstore,VI> k;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=1; i < n; i++)
+  {
+    k.rmv(i); k.add('i',i);
+  }
+  for (int i=1; i < n; i+=2)
+    k.rmv(i);
+  for (int i=n-1; i > 0; i--)
+  {
+    k.rmv(i); k.add('i',i);
+  }
+  steady_clock::time_point t2 = steady_clock::now();
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  cout << (VI ? "indexed  " : "scanning ") << n << " elements: " 
+    << t.count() << "s" << endl;
+}
+
+void benchmark_wire(int n)
+{
+  using namespace std::chrono;
+
+  aworset<int> s("x");
+  for (int r=0; r < 8; r++) 
+  {
+    aworset<int> o(string(1,'a'+r));
+    for (int i=r; i < n; i+=8) o.add(i);
+    s.join(o);
+  }
+  steady_clock::time_point t1 = steady_clock::now();
+  string b=serialize(s);
+  steady_clock::time_point t2 = steady_clock::now();
+  aworset<int> back;
+  deserialize(b,back);
+  steady_clock::time_point t3 = steady_clock::now();
+  duration<double> te = duration_cast<duration<double>>(t2 - t1);
+  duration<double> td = duration_cast<duration<double>>(t3 - t2);
+  cout << "aworset " << n << " elements: " << double(b.size())/n 
+    << " bytes/element, encode " << b.size()/te.count()/1e6 << " MB/s ("
+    << te.count()*1e9/n << " ns/element), decode " 
+    << b.size()/td.count()/1e6 << " MB/s (" << td.count()*1e9/n 
+    << " ns/element)" << endl;
+
+  // Stream of small deltas, as shipped after each operation
+  n=min(n,10000); // each join still walks the whole receiver
+  vector<string> msgs;
+  aworset<int> w("x"),rcv("y");
+  t1 = steady_clock::now();
+  for (int i=0; i < n; i++) msgs.push_back(serialize(w.add(i)));
+  t2 = steady_clock::now();
+  for (const auto & m : msgs) 
+  {
+    aworset<int> d;
+    deserialize(m,d);
+    rcv.join(d);
+  }
+  t3 = steady_clock::now();
+  te = duration_cast<duration<double>>(t2 - t1);
+  td = duration_cast<duration<double>>(t3 - t2);
+  assert (rcv.read() == w.read());
+  cout << "add deltas " << n << ": " << msgs[n/2].size() 
+    << " bytes each, encode " << te.count()*1e9/n << " ns/delta, "
+    << "decode+join " << td.count()*1e9/n << " ns/delta" << endl;
+}
+
+void benchmark_view(int n)
+{
+  using namespace std::chrono;
+
+  // Small deltas, from a peer, arriving at a replica with n elements
+  aworset<int> w("x"),base("y");
+  for (int i=0; i < n; i++) base.add(-i-1);
+  vector<string> msgs;
+  for (int i=0; i < 1000; i++) msgs.push_back(serialize(w.add(i)));
+
+  aworset<int> rcv,rcv2; rcv=base; rcv2=base;
+  size_t a0=alloc_count;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (const auto & m : msgs) 
+  {
+    aworset<int> d;
+    deserialize(m,d);
+    rcv.join(d);
+  }
+  steady_clock::time_point t2 = steady_clock::now();
+  size_t a1=alloc_count;
+  for (const auto & m : msgs) joinbytes(rcv2,m);
+  steady_clock::time_point t3 = steady_clock::now();
+  size_t a2=alloc_count;
+  assert (printed(rcv) == printed(rcv2));
+  duration<double> td = duration_cast<duration<double>>(t2 - t1);
+  duration<double> tv = duration_cast<duration<double>>(t3 - t2);
+  cout << "receiver " << n << ": decode+join " << td.count()*1e9/msgs.size() 
+    << " ns, " << double(a1-a0)/msgs.size() << " allocs/delta; "
+    << "joinbytes " << tv.count()*1e9/msgs.size() << " ns, " 
+    << double(a2-a1)/msgs.size() << " allocs/delta" << endl;
+}
+
+void benchmark_replicator(int n)
+{
+  using namespace std::chrono;
+  typedef aworset<int> S;
+
+  // A ring of 8 replicas, each adding n elements, gossiping every 10 adds
+  vector<replicator<S>*> rs;
+  loopback<S> net;
+  for (int i=0; i < 8; i++) 
+  {
+    rs.push_back(new replicator<S>(string(1,'a'+i)));
+    net.attach(*rs.back());
+  }
+  for (int i=0; i < 8; i++) 
+    net.link(rs[i]->name(),rs[(i+1)%8]->name());
+  size_t full=0;
+  duration<double> t(0);
+  for (int k=0; k < n; k++)
+  {
+    steady_clock::time_point t1 = steady_clock::now();
+    for (int i=0; i < 8; i++) 
+      rs[i]->operate([=](S & s){ return s.add(k*8+i); });
+    if (k % 10 == 9) { net.gossip(); net.run(); }
+    steady_clock::time_point t2 = steady_clock::now();
+    t+=duration_cast<duration<double>>(t2 - t1);
+    if (k % 10 == 9) 
+      for (int i=0; i < 8; i++) full+=2*serialize(rs[i]->state()).size();
+  }
+  cout << "8 replicas, " << n*8 << " adds: " << net.sent << " messages, " 
+    << net.bytes/1000 << " KB shipped (full states would be " << full/1000 
+    << " KB), " << t.count()*1e6/(n*8) << " us/add" << endl;
+  for (auto r : rs) delete r;
+}
+
+void benchmark_deltabatch(int n)
+{
+  using namespace std::chrono;
+
+  // n adds shipped as one delta, joined one by one or batched
+  aworset<int> x("x"),y("y");
+  steady_clock::time_point t1 = steady_clock::now();
+  size_t a0=alloc_count;
+  aworset<int> d;
+  for (int i=0; i < n; i++) d.join(x.add(i));
+  steady_clock::time_point t2 = steady_clock::now();
+  size_t a1=alloc_count;
+  deltabatch<aworset<int>> b;
+  for (int i=0; i < n; i++) b.add(y.add(i));
+  aworset<int> bd=b.close();
+  steady_clock::time_point t3 = steady_clock::now();
+  size_t a2=alloc_count;
+  assert (bd.read() == d.read());
+  duration<double> tj = duration_cast<duration<double>>(t2 - t1);
+  duration<double> tb = duration_cast<duration<double>>(t3 - t2);
+  cout << n << " adds: joined one by one " << tj.count()*1e9/n << " ns/op, " 
+    << double(a1-a0)/n << " allocs/op; batched " << tb.count()*1e9/n 
+    << " ns/op, " << double(a2-a1)/n << " allocs/op" << endl;
+}
+
+void benchmark_move(int n)
+{
+  aworset<int> x("x"),y("y"),d;
+  y.add(-1);
+  vector<aworset<int>> ds(n); // deltas, made before counting
+  for (int i=0; i < n; i++) ds[i]=x.add(i);
+
+  size_t a0=alloc_count;
+  for (int i=0; i < n; i++) d.join(ds[i]); // lvalue, copied
+  size_t a1=alloc_count;
+  for (int i=0; i < n; i++) { aworset<int> e; e.join(std::move(ds[i])); }
+  size_t a2=alloc_count;
+  for (int i=0; i < n; i++) ds[i]=x.add(i);
+  size_t a3=alloc_count;
+  for (int i=0; i < n; i++) join(std::move(ds[i]),y);
+  size_t a4=alloc_count;
+  cout << n << " add deltas, allocs/op: joined into a delta " 
+    << double(a1-a0)/n << ", moved into an empty one " << double(a2-a1)/n
+    << ", free join " << double(a4-a3)/n << endl;
+}
+
+template<typename S>
+void benchmark_allocator(const string & name, int n, arena * ar)
+{
+  using namespace std::chrono;
+
+  // Replicas of 100 elements, with a stream of re-add deltas
+  aworset<int,string,S> x("x"),y("y");
+  size_t a0=alloc_count;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int k=0; k < n; k+=1000)
+  {
+    if (ar != NULL) arena::current()=ar;
+    for (int i=k; i < k+1000; i++) y.join(x.add(i%100));
+    if (ar != NULL) { arena::current()=NULL; ar->reset(); }
+  }
+  steady_clock::time_point t2 = steady_clock::now();
+  size_t a1=alloc_count;
+  assert (y.read().size() == 100);
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  cout << name << ": " << double(a1-a0)/n << " heap allocs/op, " 
+    << n/t.count()/1e3 << " kops/s" << endl;
+}
+
+template<typename K>
+void benchmark_replicaid(const string & name, int n)
+{
+  using namespace std::chrono;
+
+  // 8 replicas with uuid like names, each adding n/8 elements
+  vector<aworset<int,K> > rs;
+  for (int r=0; r < 8; r++) 
+    rs.push_back(aworset<int,K>(K("6f1c2a4e-replica-" + to_string(r))));
+  size_t b0=alloc_bytes;
+  aworset<int,K> s,t;
+  for (int r=0; r < 8; r++) 
+  {
+    for (int i=r; i < n; i+=8) rs[r].add(i);
+    s.join(rs[r]);
+  }
+  size_t b1=alloc_bytes;
+  for (int r=0; r < 8; r++) rs[r].rmv(r);
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int r=0; r < 8; r++) t.join(rs[r]);
+  t.join(s);
+  steady_clock::time_point t2 = steady_clock::now();
+  duration<double> tj = duration_cast<duration<double>>(t2 - t1);
+  cout << name << " " << n << " elements: " << double(b1-b0)/n 
+    << " bytes allocated/element, join " 
+    << tj.count()*1e9/(2*n) << " ns/element" << endl;
+}
+
+void benchmark_counter(int n)
+{
+  using namespace std::chrono;
+
+  // A pncounter with n replica entries, read once per local increment
+  pncounter<long> x("x"),y;
+  for (int i=0; i < n; i++) { pncounter<long> r(to_string(i)); y.join(r.inc(i)); }
+  x.join(y);
+  long s=0;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < 10000; i++) { x.inc(); s+=x.read(); }
+  steady_clock::time_point t2 = steady_clock::now();
+  for (int i=0; i < 100; i++) { x.inc(); s-=x.fold(); }
+  steady_clock::time_point t3 = steady_clock::now();
+  assert (s != 0);
+  duration<double> tc = duration_cast<duration<double>>(t2 - t1);
+  duration<double> tf = duration_cast<duration<double>>(t3 - t2);
+  cout << n << " entries: inc+read " << tc.count()*1e9/10000 
+    << " ns/op cached, " << tf.count()*1e9/100 << " ns/op folded" << endl;
+}
+
+template<typename C>
+double benchmark_densejoin(int n, vector<C> & cs)
+{
+  using namespace std::chrono;
+
+  // Replicas that already incremented see all others, then gossip full states
+  for (int i=0; i < n; i++) cs[0].join(cs[i]);
+  for (int i=1; i < n; i++) cs[i].join(cs[0]);
+  int joins=max(10*n,1000000/n);
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int k=0; k < joins; k++) cs[k%n].join(cs[(7*k+1)%n]);
+  steady_clock::time_point t2 = steady_clock::now();
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  assert (cs[0].read() == cs[n-1].read());
+  return t.count()*1e9/joins;
+}
+
+void benchmark_densecounter(int n)
+{
+  vector<string> ids;
+  for (int i=0; i < n; i++) ids.push_back("replica-" + to_string(i));
+  membership<string> ms(ids);
+  vector<gcounter<int> > g;
+  vector<densegcounter<int> > dg;
+  vector<pncounter<int> > pn;
+  vector<densepncounter<int> > dpn;
+  for (int i=0; i < n; i++)
+  {
+    g.push_back(gcounter<int>(ids[i])); g[i].inc(i+1);
+    dg.push_back(densegcounter<int>(ms,ids[i])); dg[i].inc(i+1);
+    pn.push_back(pncounter<int>(ids[i])); pn[i].inc(i+1); pn[i].dec();
+    dpn.push_back(densepncounter<int>(ms,ids[i])); dpn[i].inc(i+1); dpn[i].dec();
+  }
+  double tg=benchmark_densejoin(n,g), tdg=benchmark_densejoin(n,dg);
+  double tpn=benchmark_densejoin(n,pn), tdpn=benchmark_densejoin(n,dpn);
+  cout << n << " replicas, join ns: gcounter " << tg << " dense " << tdg 
+    << ", pncounter " << tpn << " dense " << tdpn << endl;
+}
+
+template<typename C>
+double benchmark_bankjoin(vector<C> & cs, size_t n)
+{
+  using namespace std::chrono;
+
+  // Merges of whole shards of n counters, between 8 replicas
+  int rounds=max(1,int(20000000/(n*8)));
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int k=0; k < rounds; k++) cs[k%8].join(cs[(3*k+1)%8]);
+  steady_clock::time_point t2 = steady_clock::now();
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  return double(rounds)*n/t.count(); // counter joins per second
+}
+
+void benchmark_counterbank(size_t n)
+{
+  vector<string> ids;
+  for (int i=0; i < 8; i++) ids.push_back("replica-" + to_string(i));
+  membership<string> ms(ids);
+  vector<gcounterbank<int> > bi;
+  vector<gcounterbank<long> > bl;
+  for (int r=0; r < 8; r++) 
+  {
+    bi.push_back(gcounterbank<int>(ms,ids[r],n));
+    bl.push_back(gcounterbank<long>(ms,ids[r],n));
+    for (size_t i=r; i < n; i+=3) { bi[r].inc(i,r+1); bl[r].inc(i,r+1); }
+  }
+  cout << n << " counters, joins/s: int bank " << benchmark_bankjoin(bi,n)/1e6
+    << "M, long bank (scalar) " << benchmark_bankjoin(bl,n)/1e6 << "M";
+  if (n > 100000) { cout << endl; return; } // too many maps
+  vector<vector<gcounter<int> > > g(8,vector<gcounter<int> >(n));
+  for (int r=0; r < 8; r++) 
+    for (size_t i=r; i < n; i+=3) g[r][i]=gcounter<int>(ids[r]), g[r][i].inc(r+1);
+  struct shard // a shard of separate gcounters, joined one by one
+  {
+    vector<gcounter<int> > * cs;
+    void join(const shard & o) 
+    { 
+      for (size_t i=0; i < cs->size(); i++) (*cs)[i].join((*o.cs)[i]);
+    }
+  };
+  vector<shard> gs;
+  for (int r=0; r < 8; r++) gs.push_back(shard{&g[r]});
+  cout << ", separate gcounters " << benchmark_bankjoin(gs,n)/1e6 << "M" << endl;
+}
+
+void benchmark_ccounter(int n)
+{
+  using namespace std::chrono;
+
+  // A ccounter that has seen increments from n other replicas
+  ccounter<int> x("x"),o;
+  for (int i=0; i < n; i++) { ccounter<int> r(to_string(i)); x.join(r.inc(i)); }
+  ccounter<int> d;
+  size_t a0=alloc_count;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < 10000; i++) d=x.inc();
+  steady_clock::time_point t2 = steady_clock::now();
+  size_t a1=alloc_count;
+  o.join(d);
+  assert (o.read() == 10000 && x.read() == n*(n-1)/2+10000);
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  cout << n << " replicas: inc " << t.count()*1e9/10000 << " ns/op, " 
+    << double(a1-a0)/10000 << " allocs/op" << endl;
+}
+
+void benchmark_bcounter(int n)
+{
+  using namespace std::chrono;
+
+  // n replicas with rights, each moving some to others and spending some
+  vector<bcounter<int> > rs;
+  for (int i=0; i < n; i++) { rs.push_back(bcounter<int>(to_string(i))); rs[i].inc(100); }
+  srand(15);
+  for (int i=0; i < n; i++) // earlier transfers, known by all replicas
+    for (int k=0; k < 10; k++) rs[i].mv(1,to_string(rand()%n));
+  for (int i=1; i < n; i++) rs[0].join(rs[i]);
+  for (int i=1; i < n; i++) rs[i].join(rs[0]);
+  int ops=20000;
+  duration<double> tc(0), tj(0); // capacity checked operations, joins
+  for (int k=0; k < ops; k++)
+  {
+    int i=rand()%n, j=rand()%n;
+    steady_clock::time_point t1 = steady_clock::now();
+    bcounter<int> d=rs[i].mv(2,to_string(j));
+    steady_clock::time_point t2 = steady_clock::now();
+    rs[j].join(d);
+    steady_clock::time_point t3 = steady_clock::now();
+    rs[j].dec();
+    steady_clock::time_point t4 = steady_clock::now();
+    tc+=duration_cast<duration<double>>((t2-t1)+(t4-t3));
+    tj+=duration_cast<duration<double>>(t3-t2);
+  }
+  for (int i=1; i < n; i++) rs[0].join(rs[i]);
+  for (int i=1; i < n; i++) rs[i].join(rs[0]);
+  int sum=0;
+  for (int i=0; i < n; i++) { assert (rs[i].local() >= 0); sum+=rs[i].local(); }
+  assert (sum == rs[0].read());
+  cout << n << " replicas: mv+dec " << tc.count()*1e9/ops << " ns/op, join " 
+    << tj.count()*1e9/ops << " ns/op" << endl;
+}
+
+void benchmark_rwcounter(int n)
+{
+  using namespace std::chrono;
+
+  // An rwcounter in an ormap that has seen increments from n other replicas
+  ormap<string,rwcounter<int> > x("x");
+  for (int i=0; i < n; i++) 
+  { 
+    ormap<string,rwcounter<int> > r(to_string(i)); 
+    r["k"].inc(i);
+    x.join(r); 
+  }
+  rwcounter<int> d;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < 10000; i++) d=x["k"].inc();
+  steady_clock::time_point t2 = steady_clock::now();
+  assert (x["k"].read() == n*(n-1)/2+10000);
+  duration<double> t = duration_cast<duration<double>>(t2 - t1);
+  cout << n << " replicas: inc " << t.count()*1e9/10000 << " ns/op" << endl;
+}
+
+long scattered(long i) { return i*2654435761L % 1000000007; } // distinct ids
+
+template<typename S>
+void benchmark_elemset(const string & name, int n)
+{
+  using namespace std::chrono;
+
+  // Adds of n ids into each of two sets that share half, then their join 
+  // and n lookups of which half hit
+  S x,y;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < n; i++) x.add(scattered(i));
+  steady_clock::time_point t2 = steady_clock::now();
+  for (int i=n/2; i < n+n/2; i++) y.add(scattered(i));
+  steady_clock::time_point t3 = steady_clock::now();
+  x.join(y);
+  steady_clock::time_point t4 = steady_clock::now();
+  size_t hits=0;
+  for (int i=0; i < n; i++) hits+=x.in(scattered(i+n));
+  steady_clock::time_point t5 = steady_clock::now();
+  assert (hits == size_t(n/2));
+  cout << name << " " << n << " ns/element: add " 
+    << duration<double>(t2-t1).count()*1e9/n << ", join " 
+    << duration<double>(t4-t3).count()*1e9/n << ", in "
+    << duration<double>(t5-t4).count()*1e9/n << endl;
+}
+
+template<typename S>
+void benchmark_tombstone(const string & name, int n)
+{
+  using namespace std::chrono;
+
+  // A stream of n adds and n removes, with 1000 live elements, shipped 
+  // as deltas to another replica
+  S x,y;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < n; i++)
+  {
+    y.join(x.add(scattered(i)));
+    if (i >= 1000) y.join(x.rmv(scattered(i-1000)));
+  }
+  for (int i=n-1000; i < n; i++) y.join(x.rmv(scattered(i)));
+  steady_clock::time_point t2 = steady_clock::now();
+  assert (y.read().empty() && ! y.in(scattered(0)));
+  size_t b0=alloc_bytes;
+  S z(y); // allocates the live size of y
+  size_t b1=alloc_bytes;
+  cout << name << " " << n << ": " << duration<double>(t2-t1).count()*1e9/n 
+    << " ns/add+rmv, " << double(b1-b0)/n << " bytes/tombstone" << endl;
+}
+
+void benchmark_rworset(int n)
+{
+  using namespace std::chrono;
+
+  // n elements, one in ten removed, then lookups and reads
+  rworset<int> x("x");
+  for (int i=0; i < n; i++) x.add(i);
+  for (int i=0; i < n; i+=10) x.rmv(i);
+  int q=max(1,1000000/n); 
+  size_t hits=0;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int i=0; i < q; i++) hits+=x.in(i%n);
+  steady_clock::time_point t2 = steady_clock::now();
+  for (int i=0; i < 10; i++) hits+=x.read().size();
+  steady_clock::time_point t3 = steady_clock::now();
+  assert (hits > 0);
+  cout << n << " elements: in " << duration<double>(t2-t1).count()*1e9/q 
+    << " ns, read " << duration<double>(t3-t2).count()*1e9/10/n 
+    << " ns/element" << endl;
+}
+
+void benchmark_materialized(int n)
+{
+  using namespace std::chrono;
+
+  // n elements with two dots each, read ten times per update
+  aworset<int> x("x"),y("y");
+  for (int i=0; i < n; i++) { x.add(i); y.add(i); }
+  x.join(y); y.join(x); x.join(y.add(n));
+  long sum=0;
+  steady_clock::time_point t1 = steady_clock::now();
+  for (int k=0; k < 100; k++)
+  {
+    x.add(k); 
+    for (int r=0; r < 10; r++) sum+=x.read().size();
+  }
+  steady_clock::time_point t2 = steady_clock::now();
+  for (int k=0; k < 100; k++)
+  {
+    x.add(k); 
+    for (int r=0; r < 10; r++) 
+      for (const int & e : x.elements()) sum+=e;
+  }
+  steady_clock::time_point t3 = steady_clock::now();
+  cout << n << " elements, 10 reads per add: read() " 
+    << duration<double>(t2-t1).count()*1e9/1000/n << " ns/element, elements() "
+    << duration<double>(t3-t2).count()*1e9/1000/n << " ns/element" << endl;
+  assert (sum > 0);
+}
+
+void benchmark_ormapjoin(int n)
+{
+  using namespace std::chrono;
+  typedef ormap<string,aworset<string>> M;
+
+  // n keys, then deltas that each add or remove under one of them
+  M x("x"),y("y");
+  for (int i=0; i < n; i++) x[to_string(i)].add("a");
+  steady_clock::time_point t1 = steady_clock::now();
+  y.join(x); y.join(M()); // the keys that came in are indexed lazily
+  steady_clock::time_point t2 = steady_clock::now();
+  for (int k=0; k < 1000; k++)
+  {
+    string key=to_string(scattered(k)%n);
+    M d; 
+    if (k%2) d[key].join(x[key].add("b")); 
+    else d[key].join(x[key].rmv("a"));
+    y.join(d);
+  }
+  steady_clock::time_point t3 = steady_clock::now();
+  assert (printed(x) == printed(y));
+  // A replica that also writes, through apply
+  steady_clock::time_point t4 = steady_clock::now();
+  for (int k=0; k < 1000; k++)
+  {
+    string key=to_string(scattered(k)%n);
+    y.apply(to_string(scattered(k+1)%n),
+      [](aworset<string> & s) { return s.add("c"); });
+    M d; d[key].join(x[key].add("d")); 
+    y.join(d);
+  }
+  steady_clock::time_point t5 = steady_clock::now();
+  cout << n << " keys: full join " 
+    << duration<double>(t2-t1).count()*1e3 << " ms, delta join "
+    << duration<double>(t3-t2).count()*1e6/1000 << " us/delta, "
+    << duration<double>(t5-t4).count()*1e6/1000 << " us/delta and apply" 
+    << endl;
+}
+
+void benchmark_ormapcontext(int ids)
+{
+  using namespace std::chrono;
+  typedef ormap<string,aworset<string>> M;
+
+  // 100k keys written by a number of replicas, joined into a replica 
+  // with 100k other keys. Contexts have an entry per replica
+  const int n=100000;
+  M x("x"),y("y");
+  for (int j=0; j < ids; j++)
+  {
+    M r(to_string(j)),s("s"+to_string(j));
+    for (int i=j; i < n; i+=ids) 
+    {
+      r["x"+to_string(i)].add("a");
+      s["y"+to_string(i)].add("b");
+    }
+    x.join(r); y.join(s);
+  }
+  y.join(M()); // index what is there, see ormap::join
+  steady_clock::time_point t1 = steady_clock::now();
+  y.join(x);
+  steady_clock::time_point t2 = steady_clock::now();
+  assert (y["x0"].read().size() == 1);
+  cout << n << "+" << n << " keys, " << ids << " replicas: join " 
+    << duration<double>(t2-t1).count()*1e3 << " ms" << endl;
+}
+
+template<typename F> // Runs f(t) on t threads, returning the seconds taken
+double threaded(int threads, F f)
+{
+  using namespace std::chrono;
+  steady_clock::time_point t1 = steady_clock::now();
+  vector<thread> ts;
+  for (int t=0; t < threads; t++) ts.push_back(thread(f,t));
+  for (auto & t : ts) t.join();
+  return duration<double>(steady_clock::now()-t1).count();
+}
+
+void benchmark_shardedormap(int threads)
+{
+  typedef shardedormap<string,aworset<int>> S;
+  typedef ormap<string,aworset<int>> M;
+  const int ops=64000, keys=100000;
+
+  // Each op adds under a key of x and joins the delta into y
+  S x("x",64),y("y",64);
+  double ts=threaded(threads,[&](int t)
+  {
+    for (int i=t; i < ops; i+=threads)
+    {
+      string k=to_string(scattered(i)%keys);
+      y.join(x.shardof(k),x.apply(k,[i](aworset<int> & s) { return s.add(i); }));
+    }
+  });
+  // The same, with one ormap for each replica behind one lock
+  M mx("x"),my("y");
+  mutex mu;
+  double tm=threaded(threads,[&](int t)
+  {
+    for (int i=t; i < ops; i+=threads)
+    {
+      string k=to_string(scattered(i)%keys);
+      lock_guard<mutex> lock(mu);
+      my.join(mx.apply(k,[i](aworset<int> & s) { return s.add(i); }));
+    }
+  });
+  cout << threads << " threads: sharded " << ops/ts/1e3 << " kops/s, one lock " 
+    << ops/tm/1e3 << " kops/s" << endl;
+}
+
+void benchmark_paralleljoin(unsigned threads)
+{
+  using namespace std::chrono;
+  typedef ormap<string,aworset<int>> M;
+
+  // A recovering replica, that saw half of the state, joins all of it.
+  // Some of what it saw was removed since
+  const int n=1000000, keys=100000;
+  aworset<int> y("y"),z("z");
+  for (int i=0; i < n; i++) 
+  {
+    y.add(i);
+    if (i == n/2) z.join(y);
+    if (i > n/2 && i%10 == 0) y.rmv(i-n/2);
+  }
+  M my("y"),mz("z");
+  for (int i=0; i < keys; i++) 
+  {
+    my[to_string(i)].add(i);
+    if (i == keys/2) mz.join(my);
+    if (i > keys/2 && i%10 == 0) my[to_string(i-keys/2)].rmv(i-keys/2);
+  }
+
+  steady_clock::time_point t1 = steady_clock::now();
+  z.join(y,threads);
+  steady_clock::time_point t2 = steady_clock::now();
+  mz.join(my,threads);
+  steady_clock::time_point t3 = steady_clock::now();
+  assert (z.read() == y.read() && printed(mz["0"]) == printed(my["0"]));
+  cout << threads << " threads: aworset of " << n << " " 
+    << duration<double>(t2-t1).count()*1e3 << " ms, ormap of " << keys << " " 
+    << duration<double>(t3-t2).count()*1e3 << " ms" << endl;
+}
+
+void benchmark_dotstores()
+{
+  cout << "--- Benchmark: map vs flat dot store --\n";
+  for (int n = 10000; n <= 1000000; n*=10)
+  {
+    benchmark_dotstore<mapstore>("map ",n);
+    benchmark_dotstore<flatstore>("flat",n);
+  }
+}
+
+void benchmark_valueindexes()
+{
+  cout << "--- Benchmark: rmv by value with and without index --\n";
+  for (int n = 1000; n <= 100000; n*=10)
+  {
+    if (n <= 10000) benchmark_valueindex<false>(n); // quadratic
+    benchmark_valueindex<true>(n);
+  }
+}
+
+void benchmark_wires()
+{
+  cout << "--- Benchmark: wire format encode and decode --\n";
+  for (int n = 10000; n <= 1000000; n*=10)
+    benchmark_wire(n);
+}
+
+void benchmark_replicators()
+{
+  cout << "--- Benchmark: delta-interval anti-entropy --\n";
+  for (int n = 100; n <= 400; n*=2)
+    benchmark_replicator(n);
+}
+
+void benchmark_deltabatches()
+{
+  cout << "--- Benchmark: per operation joins vs delta batches --\n";
+  for (int n = 1000; n <= 10000; n*=10)
+    benchmark_deltabatch(n);
+}
+
+void benchmark_moves()
+{
+  cout << "--- Benchmark: allocations of joins of temporaries --\n";
+  benchmark_move(10000);
+}
+
+void benchmark_allocators()
+{
+  cout << "--- Benchmark: heap vs arena vs pool allocation --\n";
+  arena ar;
+  benchmark_allocator<mapstore>("heap",100000,NULL);
+  benchmark_allocator<arenastore>("arena deltas",100000,&ar);
+  benchmark_allocator<poolstore>("pool",100000,NULL);
+}
+
+void benchmark_replicaids()
+{
+  cout << "--- Benchmark: string vs interned replica ids --\n";
+  for (int n = 10000; n <= 100000; n*=10)
+  {
+    benchmark_replicaid<string>("string",n);
+    benchmark_replicaid<replicaid>("replicaid",n);
+  }
+}
+
+void benchmark_counters()
+{
+  cout << "--- Benchmark: cached vs folded counter reads --\n";
+  for (int n = 10; n <= 10000; n*=10)
+    benchmark_counter(n);
+}
+
+void benchmark_densecounters()
+{
+  cout << "--- Benchmark: map vs fixed membership counters --\n";
+  for (int n : {8, 64, 1024})
+    benchmark_densecounter(n);
+}
+
+void benchmark_counterbanks()
+{
+  cout << "--- Benchmark: columnar counter banks --\n";
+#if defined(__AVX2__)
+  cout << "maxjoin with AVX2\n";
+#elif defined(__SSE4_1__)
+  cout << "maxjoin with SSE4.1\n";
+#else
+  cout << "maxjoin scalar\n";
+#endif
+  for (size_t n = 1000; n <= 1000000; n*=10)
+    benchmark_counterbank(n);
+}
+
+void benchmark_ccounters()
+{
+  cout << "--- Benchmark: ccounter increments --\n";
+  for (int n = 1; n <= 10000; n*=10)
+    benchmark_ccounter(n);
+}
+
+void benchmark_bcounters()
+{
+  cout << "--- Benchmark: bcounter rights transfers --\n";
+  for (int n = 10; n <= 1000; n*=10)
+    benchmark_bcounter(n);
+}
+
+void benchmark_rwcounters()
+{
+  cout << "--- Benchmark: rwcounter increments in an ormap --\n";
+  for (int n = 1; n <= 10000; n*=10)
+    benchmark_rwcounter(n);
+}
+
+void benchmark_elemsets()
+{
+  cout << "--- Benchmark: tree vs hash element sets --\n";
+  for (int n = 10000; n <= 10000000; n*=10)
+  {
+    benchmark_elemset<gset<long> >("gset tree",n);
+    benchmark_elemset<gset<long,allocator,hashstore> >("gset hash",n);
+    benchmark_elemset<twopset<long> >("twopset tree",n);
+    benchmark_elemset<twopset<long,string,allocator,hashstore> >("twopset hash",n);
+  }
+}
+
+void benchmark_tombstones()
+{
+  cout << "--- Benchmark: twopset tombstones under churn --\n";
+  for (int n = 100000; n <= 10000000; n*=10)
+  {
+    benchmark_tombstone<twopset<long> >("tree",n);
+    benchmark_tombstone<twopset<long,string,allocator,hashstore> >("hash",n);
+    benchmark_tombstone<twopset<long,string,allocator,bloomstore<> > >("bloom",n);
+  }
+}
+
+void benchmark_rworsets()
+{
+  cout << "--- Benchmark: rworset in and read --\n";
+  for (int n = 1000; n <= 100000; n*=10)
+    benchmark_rworset(n);
+}
+
+void benchmark_materializeds()
+{
+  cout << "--- Benchmark: aworset reads --\n";
+  for (int n = 1000; n <= 100000; n*=10)
+    benchmark_materialized(n);
+}
+
+void benchmark_ormapjoins()
+{
+  cout << "--- Benchmark: ormap join of full states and of deltas --\n";
+  for (int n = 1000; n <= 100000; n*=10)
+    benchmark_ormapjoin(n);
+}
+
+void benchmark_ormapcontexts()
+{
+  cout << "--- Benchmark: ormap join with large contexts --\n";
+  for (int ids = 1; ids <= 256; ids*=16)
+    benchmark_ormapcontext(ids);
+}
+
+void benchmark_shardedormaps()
+{
+  cout << "--- Benchmark: sharded ormap vs one lock, " 
+    << thread::hardware_concurrency() << " cores --\n";
+  for (int t = 1; t <= 32; t*=2)
+    benchmark_shardedormap(t);
+}
+
+void benchmark_paralleljoins()
+{
+  cout << "--- Benchmark: joins of full states on threads, " 
+    << thread::hardware_concurrency() << " cores --\n";
+  for (unsigned t = 1; t <= 32; t*=2)
+    benchmark_paralleljoin(t);
+}
+
+void benchmark_views()
+{
+  cout << "--- Benchmark: decode and join vs join of encoded deltas --\n";
+  for (int n = 100; n <= 100000; n*=10)
+    benchmark_view(n);
+}
+
+void example_gset()
+{
+  gset<string> a,b;
+
+  a.add("red");
+  b.add("blue");
+
+  cout << join(a,b) << endl; // GSet: ( blue red )
+}
+
+void example_twopset()
+{
+  twopset<float> a,b;
+
+  a.add(3.1415);
+  a.rmv(3.1415);
+  b.add(42);
+  b.add(3.1415);
+
+  cout << join(a,b) << endl; // 2PSet: S( 42 ) T ( 3.1415 )
+
+  gset<float> c;
+  c.add(42);
+
+  cout << ( join(a,b).read() == c.read() ) << endl; // true
+}
+
+void example_pair()
+{
+  pair<gset<int>,gset<char>> a,b,c;
 
   a.first.add(0); 
   b.first.add(1);
@@ -1021,12 +3268,68 @@ void test_rwcounter()
 
 int main(int argc, char * argv[])
 {
+  if (argc > 1 && string(argv[1]) == "bench") // run only the benchmarks
+  {
+    string b = argc > 2 ? argv[2] : ""; // optionally a single one, by name
+    if (b == "" || b == "aworset") benchmark1();
+    if (b == "" || b == "compact") benchmark_compact();
+    if (b == "" || b == "dotstore") benchmark_dotstores();
+    if (b == "" || b == "valueindex") benchmark_valueindexes();
+    if (b == "" || b == "wire") benchmark_wires();
+    if (b == "" || b == "view") benchmark_views();
+    if (b == "" || b == "replicator") benchmark_replicators();
+    if (b == "" || b == "deltabatch") benchmark_deltabatches();
+    if (b == "" || b == "move") benchmark_moves();
+    if (b == "" || b == "allocator") benchmark_allocators();
+    if (b == "" || b == "replicaid") benchmark_replicaids();
+    if (b == "" || b == "counter") benchmark_counters();
+    if (b == "" || b == "densecounter") benchmark_densecounters();
+    if (b == "" || b == "counterbank") benchmark_counterbanks();
+    if (b == "" || b == "ccounter") benchmark_ccounters();
+    if (b == "" || b == "bcounter") benchmark_bcounters();
+    if (b == "" || b == "rwcounter") benchmark_rwcounters();
+    if (b == "" || b == "elemset") benchmark_elemsets();
+    if (b == "" || b == "tombstone") benchmark_tombstones();
+    if (b == "" || b == "rworset") benchmark_rworsets();
+    if (b == "" || b == "materialized") benchmark_materializeds();
+    if (b == "" || b == "ormapjoin") benchmark_ormapjoins();
+    if (b == "" || b == "ormapcontext") benchmark_ormapcontexts();
+    if (b == "" || b == "shardedormap") benchmark_shardedormaps();
+    if (b == "" || b == "paralleljoin") benchmark_paralleljoins();
+    return 0;
+  }
+
+  test_dotcontext();
   test_gset();
   test_twopset();
   test_gcounter();
   test_pncounter();
   test_lexcounter();
   test_aworset();
+  test_flatstore();
+  test_valueindex();
+  test_wire();
+  test_views();
+  test_replicator();
+  test_deltabatch();
+  test_moves();
+  test_allocators();
+  test_replicaid();
+  test_cachedtotals();
+  test_densecounters();
+  test_counterbanks();
+  test_ccounter();
+  test_bcounter();
+  test_bagown();
+  test_hashsets();
+  test_bloomtombs();
+  test_rworsetindex();
+  test_materialized();
+  test_ormapindex();
+  test_ormapcontext();
+  test_mapapply();
+  test_shardedormap();
+  test_paralleljoin();
   test_rworset();
   test_mvreg();
 //  test_maxord();